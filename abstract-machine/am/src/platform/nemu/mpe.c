@@ -2,17 +2,35 @@
 #include <stdatomic.h>
 #include <klib-macros.h>
 
+// set by the boot code when NEMU emulates more than one hart
+int _mpe_nr_cpu = 1;
+static void (* volatile mpe_entry)() = NULL;
+
+// the other harts wait here until mpe_init() is called
+void _mpe_park() {
+  while (mpe_entry == NULL) ;
+  mpe_entry();
+  panic("MPE entry returns");
+}
+
 bool mpe_init(void (*entry)()) {
+  mpe_entry = entry;
   entry();
   panic("MPE entry returns");
 }
 
 int cpu_count() {
-  return 1;
+  return _mpe_nr_cpu;
 }
 
 int cpu_current() {
+#if defined(__riscv)
+  int id;
+  asm volatile ("mv %0, tp" : "=r"(id));
+  return id;
+#else
   return 0;
+#endif
 }
 
 int atomic_xchg(int *addr, int newval) {
@@ -19,6 +19,8 @@ void halt(int code) {
 }
 
 void _trm_init() {
+  // the stacks of the other CPUs are at the end of pmem
+  heap.end = (char *)heap.end - (cpu_count() - 1) * MPE_STACK_SIZE;
   int ret = main(mainargs);
   halt(ret);
 }
@@ -1,7 +1,8 @@
 include $(AM_HOME)/scripts/isa/riscv.mk
 include $(AM_HOME)/scripts/platform/nemu.mk
 CFLAGS  += -DISA_H=\"riscv/riscv.h\"
-COMMON_CFLAGS += -march=rv32im_zicsr -mabi=ilp32   # overwrite
+# SMP=y adds the A extension, for NEMU built with CONFIG_SMP
+COMMON_CFLAGS += -march=rv32im$(if $(filter y,$(SMP)),a)_zicsr -mabi=ilp32  # overwrite
 LDFLAGS       += -melf32lriscv                     # overwrite
 
 AM_SRCS += riscv/nemu/start.S \
@@ -0,0 +1,68 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __BTRACE_DEF_H__
+#define __BTRACE_DEF_H__
+
+#include <stdint.h>
+
+/* The binary instruction trace written with CONFIG_BTRACE and read by
+ * tools/nemu-tracedump. It does not depend on the configuration of NEMU.
+ *
+ * A trace is a BTraceHeader followed by chunks. A chunk is a BTraceChunk
+ * followed by `comp_len` bytes, which hold the `raw_len` bytes of its
+ * records compressed. If `comp_len` equals `raw_len`, they are stored as
+ * is. A compressed chunk is a sequence of
+ *   literal length, literals, match length[, match offset]
+ * until `raw_len` bytes are produced. A match copies `match length` bytes
+ * starting at `match offset` bytes back in the output, and may overlap
+ * with itself. A match length of 0 has no offset.
+ *
+ * The records of a chunk are the instructions `first_inst`,
+ * `first_inst + 1`, ..., unless some instructions are skipped, e.g. by the
+ * trace window. Each record is
+ *   flags                 instruction length | BT_PC | BT_REG | BT_MEM | BT_SKIP
+ *   [skipped]             if BT_SKIP, the instructions not traced before it
+ *   [pc delta]            if BT_PC, otherwise the pc is the static next pc
+ *                         of the previous record
+ *   instruction           raw bytes in the order of the guest memory
+ *   [rd, value]           if BT_REG, the register written and its value
+ *   [memory address delta] if BT_MEM
+ * The deltas are from the previous ones in the chunk, both starting from 0.
+ * Numbers are LEB128 varints, and the deltas are zigzag-encoded before.
+ */
+
+#define BTRACE_MAGIC "NEMUBTR1"
+#define BTRACE_CHUNK_SIZE (64 * 1024) // raw bytes of a chunk at most
+
+typedef struct {
+  char magic[8];
+  char isa[16];       // e.g. "riscv32"
+  uint32_t word_size; // bytes of a guest word
+  uint32_t flags;     // which of BT_REG and BT_MEM may appear
+} BTraceHeader;
+
+typedef struct {
+  uint64_t first_inst;
+  uint64_t last_inst;
+  uint32_t nr_record;
+  uint32_t raw_len;
+  uint32_t comp_len;
+  uint32_t pad;
+} BTraceChunk;
+
+enum { BT_ILEN = 0x0f, BT_PC = 0x10, BT_REG = 0x20, BT_MEM = 0x40, BT_SKIP = 0x80 };
+
+#endif
@@ -44,6 +44,13 @@ typedef MUXDEF(PMEM64, uint64_t, uint32_t) paddr_t;
 #define FMT_PADDR MUXDEF(PMEM64, "0x%016" PRIx64, "0x%08" PRIx32)
 typedef uint16_t ioaddr_t;
 
+#ifdef CONFIG_TARGET_LIB
+// every host thread runs its own machine, which owns the state marked so
+#define MACHINE_LOCAL __thread
+#else
+#define MACHINE_LOCAL
+#endif
+
 #include <debug.h>
 
 #endif
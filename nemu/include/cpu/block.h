@@ -0,0 +1,59 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_BLOCK_H__
+#define __CPU_BLOCK_H__
+
+#include <cpu/decode.h>
+
+#define BLOCK_MAX_INST 64
+
+typedef struct Block {
+  vaddr_t pc;
+  int nr_inst;
+  struct Block *next; // next block in the same hash bucket
+  struct {
+    vaddr_t pc;
+    struct Block *b;
+  } link[2];          // successors resolved before, e.g. taken and fall-through
+#ifdef CONFIG_ENGINE_JIT
+  uint32_t nr_exec;   // times executed before being compiled
+  int (*native)(void); // compiled code, returns the number of instructions executed
+#endif
+  Decode ops[];       // pre-decoded instructions
+} Block;
+
+Block* block_lookup(vaddr_t pc);
+bool block_warm(vaddr_t pc);
+Block* block_new(vaddr_t pc);
+void block_commit(Block *b, int nr_inst);
+void block_flush_all();
+void block_flush_page(paddr_t addr);
+
+#if defined(CONFIG_DIFFTEST) || defined(CONFIG_WATCHPOINT) || defined(CONFIG_BTRACE)
+// the result of every instruction in a block should be checked
+#define BLOCK_TRACE 1
+#endif
+
+// Account and check an instruction executed within a block.
+// Return whether the execution of the block can go on.
+bool block_trace(Decode *s, vaddr_t dnpc);
+
+#ifdef CONFIG_ENGINE_JIT
+void jit_compile(Block *b);
+void jit_flush();
+#endif
+
+#endif
@@ -24,9 +24,38 @@ typedef struct Decode
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
-  IFDEF(CONFIG_ITRACE, char logbuf[128]);
+  IFDEF(CONFIG_DECODE_CACHE, const void *handler); // body of the matched INSTPAT
 } Decode;
 
+// --- decode cache ---
+#ifdef CONFIG_DECODE_CACHE
+bool decode_cacheable(vaddr_t pc);
+bool decode_cache_fetch(Decode *s);
+void decode_cache_fill(Decode *s, const void *handler);
+void decode_cache_update(Decode *s);
+void decode_cache_flush_page(paddr_t addr);
+#endif
+
+// --- INSTPAT profiling ---
+#ifdef CONFIG_INSTPAT_PROFILE
+typedef struct InstpatCounter {
+  const char *name;
+  const char *pattern;
+  int line;
+  uint64_t count;
+  struct InstpatCounter *next;
+} InstpatCounter;
+
+void instpat_profile_register(InstpatCounter *c);
+void instpat_profile_dump();
+
+#define __INSTPAT_NAME(name, ...) name
+#define INSTPAT_PROFILE(pat, pat_name) do { \
+  static InstpatCounter __c = { .name = str(pat_name), .pattern = pat, .line = __LINE__ }; \
+  if (__c.count ++ == 0) instpat_profile_register(&__c); \
+} while (0)
+#endif
+
 // --- pattern matching mechanism ---
 __attribute__((always_inline))
 static inline void pattern_decode(const char *str, int len,
@@ -88,16 +117,42 @@ finish:
 
 
 // --- pattern matching wrappers for decode ---
-#define INSTPAT(pattern, ...) do { \
+// Every pattern gets a label named by its line in front of its execute body.
+// With the decode cache, the label is recorded on the first match, and later
+// executions of the same PC jump there directly from INSTPAT_START(). With
+// the decision tree generated by tools/instpat-tree, INSTPAT_START() jumps
+// to the label of the matching pattern, and falls through to the sequential
+// matching below if no pattern matches.
+#if defined(CONFIG_DECODE_CACHE) || defined(CONFIG_INSTPAT_TREE)
+#define INSTPAT_LABEL(label) label: __attribute__((unused));
+#else
+#define INSTPAT_LABEL(label)
+#endif
+
+#define INSTPAT(pattern, ...) __INSTPAT(concat(__instpat_, __LINE__), pattern, ##__VA_ARGS__)
+#define __INSTPAT(label, pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    IFDEF(CONFIG_DECODE_CACHE, decode_cache_fill(s, &&label);) \
+    INSTPAT_LABEL(label) \
+    IFDEF(CONFIG_INSTPAT_PROFILE, INSTPAT_PROFILE(pattern, __INSTPAT_NAME(__VA_ARGS__));) \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
 } while (0)
 
-#define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name);
+#ifdef CONFIG_INSTPAT_TREE
+#include <instpat-tree.h>
+#define INSTPAT_TREE_GOTO(label) do { \
+  IFDEF(CONFIG_DECODE_CACHE, decode_cache_fill(s, &&label)); \
+  goto label; \
+} while (0)
+#endif
+
+#define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name); \
+  IFDEF(CONFIG_DECODE_CACHE, if (s->handler != NULL) goto *(s->handler)); \
+  IFDEF(CONFIG_INSTPAT_TREE, concat(__instpat_tree_, __LINE__)((uint64_t)INSTPAT_INST(s)));
 #define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
 
 #endif
@@ -0,0 +1,40 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_PERF_H__
+#define __CPU_PERF_H__
+
+#include <common.h>
+
+// guest events counted with CONFIG_PERF_COUNTER
+enum {
+  PERF_LOAD, PERF_STORE, PERF_AMO,
+  PERF_BRANCH_TAKEN, PERF_BRANCH_NOT_TAKEN,
+  PERF_EXCEPTION, PERF_INTR,
+  NR_PERF_EVENT
+};
+
+// phases of NEMU whose host time is measured (unit: us)
+enum { PERF_TIME_INIT, PERF_TIME_EXEC, PERF_TIME_DEVICE, PERF_TIME_JIT, NR_PERF_TIME };
+
+extern MACHINE_LOCAL uint64_t g_perf[NR_PERF_EVENT];
+extern MACHINE_LOCAL uint64_t g_perf_time[NR_PERF_TIME];
+
+void init_perf(const char *file);
+void perf_dump(FILE *fp);
+bool perf_save(const char *file);
+void perf_statistic();
+
+#endif
@@ -29,9 +29,10 @@
     if (!(cond)) { \
       MUXDEF(CONFIG_TARGET_AM, printf(ANSI_FMT(format, ANSI_FG_RED) "\n", ## __VA_ARGS__), \
         (fflush(stdout), fprintf(stderr, ANSI_FMT(format, ANSI_FG_RED) "\n", ##  __VA_ARGS__))); \
-      IFNDEF(CONFIG_TARGET_AM, extern FILE* log_fp; fflush(log_fp)); \
+      IFNDEF(CONFIG_TARGET_AM, extern MACHINE_LOCAL FILE* log_fp; fflush(log_fp)); \
       extern void assert_fail_msg(); \
       assert_fail_msg(); \
+      IFDEF(CONFIG_TARGET_LIB, extern void machine_abort(); machine_abort()); \
       assert(cond); \
     } \
   } while (0)
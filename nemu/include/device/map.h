@@ -20,6 +20,7 @@
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
+uint8_t* map_space(size_t *size);
 
 typedef struct {
   const char *name;
@@ -28,6 +29,7 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  IFDEF(CONFIG_PERF_COUNTER, uint64_t nr_read; uint64_t nr_write;)
 } IOMap;
 
 static inline bool map_inside(IOMap *map, paddr_t addr) {
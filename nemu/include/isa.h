@@ -27,15 +27,31 @@ typedef concat(__GUEST_ISA__, _ISADecodeInfo) ISADecodeInfo;
 // monitor
 extern unsigned char isa_logo[];
 void init_isa();
+IFDEF(CONFIG_SMP, void isa_hart_init(int hartid));
 
 // reg
-extern CPU_state cpu;
+#ifdef CONFIG_SMP
+// every hart runs in its own host thread, which sees its own `cpu`
+#define HART_LOCAL __thread
+#else
+#define HART_LOCAL MACHINE_LOCAL
+#endif
+extern HART_LOCAL CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
 
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+int isa_exec_block(struct Decode *s, int n);
+bool isa_block_end(struct Decode *s);
+// calls and returns by the convention of the ABI
+enum { JUMP_NONE, JUMP_CALL, JUMP_RET };
+int isa_jump_kind(struct Decode *s);
+// the register written by the instruction and its value, or -1
+int isa_inst_rd(struct Decode *s, word_t *val);
+// conditional branches, which end a block like other control transfers
+bool isa_is_branch(struct Decode *s);
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
@@ -31,7 +31,30 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+#ifdef CONFIG_DECODE_CACHE
+/* mark the page of `addr` as holding cached instructions,
+ * a later store to the page will drop them */
+void pmem_mark_code(paddr_t addr);
+#endif
+
+#ifndef CONFIG_TARGET_AM
+/* Replace `len` bytes of pmem from `addr` with a copy-on-write mapping of
+ * the file `fd` from `offset`, or with zero pages if `fd` is -1. All of
+ * `addr`, `len` and `offset` should be page aligned. */
+void pmem_map(paddr_t addr, size_t len, int fd, off_t offset);
+/* Copy `len` bytes from the host into pmem at `addr`, dropping the
+ * instructions cached from the pages written. */
+void pmem_write_bytes(paddr_t addr, const void *buf, size_t len);
+#endif
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+/* Atomic read-modify-write. `op` computes the new value from the old one,
+ * and may be called again if another hart stores to the word meanwhile.
+ * The old value is returned. */
+word_t paddr_amo(paddr_t addr, int len, word_t (*op)(word_t old, word_t src), word_t src);
+/* store `data` only if the memory still holds `expect` */
+bool paddr_cas(paddr_t addr, int len, word_t expect, word_t data);
+
 #endif
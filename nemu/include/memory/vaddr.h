@@ -21,6 +21,8 @@
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
+word_t vaddr_amo(vaddr_t addr, int len, word_t (*op)(word_t old, word_t src), word_t src);
+bool vaddr_cas(vaddr_t addr, int len, word_t expect, word_t data);
 
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
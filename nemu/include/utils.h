@@ -28,11 +28,34 @@ typedef struct {
   uint32_t halt_ret;
 } NEMUState;
 
-extern NEMUState nemu_state;
+extern MACHINE_LOCAL NEMUState nemu_state;
 
 // ----------- timer -----------
 
 uint64_t get_time();
+uint64_t get_guest_time();
+#ifdef CONFIG_TIME_ICOUNT
+uint64_t get_icount();
+void icount_skip(uint64_t n);
+uint64_t get_icount_skipped();
+#endif
+
+// ----------- symbol -----------
+
+void init_symbol(const char *elf_file);
+const char* symbol_find(vaddr_t addr, vaddr_t *start);
+bool symbol_lookup(const char *name, vaddr_t *start, vaddr_t *end);
+
+// ----------- trace window -----------
+
+#ifdef CONFIG_TRACE
+extern MACHINE_LOCAL bool g_trace_filter;
+void trace_block(vaddr_t pc, vaddr_t last);
+bool trace_window_add(const char *kind, const char *arg1, const char *arg2);
+bool trace_window_parse(char *spec);
+void trace_window_clear();
+void trace_window_show();
+#endif
 
 // ----------- log -----------
 
@@ -56,9 +79,19 @@ uint64_t get_time();
 
 #define ANSI_FMT(str, fmt) fmt str ANSI_NONE
 
-#define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
+#ifdef CONFIG_LOG_ASYNC
+void log_async(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_flush();
+
+#define log_write(...) \
   do { \
-    extern FILE* log_fp; \
+    extern bool log_enable(); \
+    if (log_enable()) log_async(__VA_ARGS__); \
+  } while (0)
+#else
+#define log_write(...) IFNDEF(CONFIG_TARGET_AM, \
+  do { \
+    extern MACHINE_LOCAL FILE* log_fp; \
     extern bool log_enable(); \
     if (log_enable() && log_fp != NULL) { \
       fprintf(log_fp, __VA_ARGS__); \
@@ -66,6 +99,7 @@ uint64_t get_time();
     } \
   } while (0) \
 )
+#endif
 
 #define _Log(...) \
   do { \
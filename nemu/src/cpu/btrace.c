@@ -0,0 +1,170 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/decode.h>
+#include <btrace-def.h>
+
+/* Write the binary instruction trace described in btrace-def.h. Records
+ * are encoded into a chunk in memory, and a full chunk is compressed and
+ * written with a single fwrite().
+ */
+
+#define MAX_RECORD 64
+#define HASH_BITS 12
+
+extern MACHINE_LOCAL uint64_t g_nr_guest_inst;
+bool log_enable();
+
+vaddr_t g_btrace_mem = 0;        // the last address accessed by vaddr_*()
+bool g_btrace_mem_valid = false; // whether the current instruction accesses memory
+
+static FILE *fp = NULL;
+static uint8_t chunk[BTRACE_CHUNK_SIZE];
+static uint8_t comp[BTRACE_CHUNK_SIZE * 2];
+static int pos = 0;
+static uint32_t nr_record = 0;
+static uint64_t first_inst = 0, next_inst = 0;
+static vaddr_t last_pc = 0, last_mem = 0;
+static uint64_t raw_total = 0, comp_total = 0;
+
+static uint8_t* put_varint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) { *p ++ = (v & 0x7f) | 0x80; v >>= 7; }
+  *p ++ = v;
+  return p;
+}
+
+static uint8_t* put_delta(uint8_t *p, vaddr_t to, vaddr_t from) {
+  int64_t d = (sword_t)(to - from);
+  return put_varint(p, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+}
+
+// Greedy LZ77 with a hash table of the last position of every 4 bytes.
+static int compress(uint8_t *out, const uint8_t *in, int len) {
+  static int32_t table[1 << HASH_BITS];
+  memset(table, -1, sizeof(table));
+  uint8_t *p = out;
+  int lit = 0, i = 0;
+  while (i + 4 <= len) {
+    uint32_t v;
+    memcpy(&v, in + i, 4);
+    uint32_t h = (v * 2654435761u) >> (32 - HASH_BITS);
+    int ref = table[h];
+    table[h] = i;
+    if (ref < 0 || memcmp(in + ref, in + i, 4) != 0) { i ++; continue; }
+    int m = 4;
+    while (i + m < len && in[ref + m] == in[i + m]) m ++;
+    p = put_varint(p, i - lit);
+    memcpy(p, in + lit, i - lit);
+    p += i - lit;
+    p = put_varint(p, m);
+    p = put_varint(p, i - ref);
+    i += m;
+    lit = i;
+  }
+  p = put_varint(p, len - lit);
+  memcpy(p, in + lit, len - lit);
+  p += len - lit;
+  p = put_varint(p, 0);
+  return p - out;
+}
+
+static void flush_chunk() {
+  if (nr_record == 0) return;
+  BTraceChunk c = { .first_inst = first_inst, .last_inst = next_inst - 1, .nr_record = nr_record, .raw_len = pos };
+  c.comp_len = compress(comp, chunk, pos);
+  bool raw = (c.comp_len >= c.raw_len);
+  if (raw) c.comp_len = c.raw_len;
+  fwrite(&c, sizeof(c), 1, fp);
+  fwrite(raw ? chunk : comp, c.comp_len, 1, fp);
+  raw_total += c.raw_len;
+  comp_total += c.comp_len;
+  pos = 0;
+  nr_record = 0;
+}
+
+void btrace_inst(Decode *s) {
+  bool mem = g_btrace_mem_valid;
+  g_btrace_mem_valid = false;
+  if (fp == NULL || !log_enable()) return;
+
+  uint64_t inst = g_nr_guest_inst - 1;
+  if (pos > BTRACE_CHUNK_SIZE - MAX_RECORD) flush_chunk();
+  if (nr_record == 0) {
+    first_inst = next_inst = inst;
+    last_pc = last_mem = 0;
+  }
+
+  uint8_t *p = chunk + pos;
+  uint8_t *flags = p ++;
+  int ilen = s->snpc - s->pc;
+  *flags = ilen;
+  if (inst != next_inst) {
+    *flags |= BT_SKIP;
+    p = put_varint(p, inst - next_inst);
+  }
+  if (s->pc != last_pc) {
+    *flags |= BT_PC;
+    p = put_delta(p, s->pc, last_pc);
+  }
+  memcpy(p, &s->isa.inst, ilen);
+  p += ilen;
+#ifdef CONFIG_BTRACE_REG
+  word_t val;
+  int rd = isa_inst_rd(s, &val);
+  if (rd >= 0) {
+    *flags |= BT_REG;
+    *p ++ = rd;
+    p = put_varint(p, val);
+  }
+#endif
+  if (mem) {
+    *flags |= BT_MEM;
+    p = put_delta(p, g_btrace_mem, last_mem);
+    last_mem = g_btrace_mem;
+  }
+  last_pc = s->snpc;
+  next_inst = inst + 1;
+  pos = p - chunk;
+  nr_record ++;
+}
+
+void btrace_flush() {
+  if (fp == NULL) return;
+  flush_chunk();
+  fflush(fp);
+}
+
+static void btrace_close() {
+  if (fp == NULL) return;
+  btrace_flush();
+  Log("Binary trace: %" PRIu64 " bytes of records are compressed into %" PRIu64 " bytes",
+      raw_total, comp_total);
+  fclose(fp);
+  fp = NULL;
+}
+
+void init_btrace(const char *file) {
+  if (file == NULL) return;
+  fp = fopen(file, "wb");
+  Assert(fp, "Can not open '%s'", file);
+  BTraceHeader h = { .magic = BTRACE_MAGIC, .word_size = sizeof(word_t),
+    .flags = MUXDEF(CONFIG_BTRACE_REG, BT_REG, 0) | MUXDEF(CONFIG_BTRACE_MEM, BT_MEM, 0) };
+  strncpy(h.isa, str(__GUEST_ISA__), sizeof(h.isa) - 1);
+  fwrite(&h, sizeof(h), 1, fp);
+  atexit(btrace_close);
+  Log("Binary trace is written to %s", file);
+}
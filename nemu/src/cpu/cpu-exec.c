@@ -16,6 +16,8 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/block.h>
+#include <cpu/perf.h>
 #include <locale.h>
 #include "/home/zs/ysyx-workbench/nemu/src/monitor/sdb/watchpoint.h"
 #include "/home/zs/ysyx-workbench/nemu/src/monitor/sdb/expr.h"
@@ -26,18 +28,114 @@
  */
 #define MAX_INST_TO_PRINT 10
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_inst = 0;
-static uint64_t g_timer = 0; // unit: us
-static bool g_print_step = false;
+HART_LOCAL CPU_state cpu = {};
+MACHINE_LOCAL uint64_t g_nr_guest_inst = 0;
+static MACHINE_LOCAL uint64_t g_timer = 0; // unit: us
+static MACHINE_LOCAL bool g_print_step = false;
 
 void device_update();
+void simpoint_block(vaddr_t pc, int nr_inst);
+void simpoint_inst(Decode *s);
+void simpoint_dump();
+
+#ifdef CONFIG_PROFILER
+extern uint64_t g_profile_next;
+void profiler_jump(int kind, vaddr_t pc, vaddr_t target);
+void profiler_sample(vaddr_t pc, uint64_t nr_inst);
+void profiler_dump();
+#endif
+#ifdef CONFIG_FTRACE
+void ftrace_jump(int kind, vaddr_t pc, vaddr_t target);
+void ftrace_flush();
+#endif
+
+#if defined(CONFIG_PROFILER) || defined(CONFIG_FTRACE) || defined(CONFIG_PERF_COUNTER)
+#define TRACE_CONTROL 1
+// `s` is the last instruction executed, and `cpu.pc` is the next one.
+// The sample is taken before the stack is changed by `s`.
+// Branches end a block, so checking the last instruction of a block is enough,
+// but the samples in a block are taken by profiler_block() first.
+static inline void trace_control(Decode *s) {
+  IFDEF(CONFIG_PROFILER, if (unlikely(g_nr_guest_inst >= g_profile_next)) profiler_sample(s->pc, g_nr_guest_inst));
+  IFDEF(CONFIG_PERF_COUNTER, if (isa_is_branch(s)) g_perf[cpu.pc != s->snpc ? PERF_BRANCH_TAKEN : PERF_BRANCH_NOT_TAKEN] ++);
+#if defined(CONFIG_PROFILER) || defined(CONFIG_FTRACE)
+  if (cpu.pc != s->snpc) {
+    int kind = isa_jump_kind(s);
+    if (kind == JUMP_NONE) return;
+    IFDEF(CONFIG_PROFILER, profiler_jump(kind, s->pc, cpu.pc));
+    IFDEF(CONFIG_FTRACE, ftrace_jump(kind, s->pc, cpu.pc));
+  }
+#endif
+}
+#endif
+
+#if defined(CONFIG_PROFILER) && defined(CONFIG_BLOCK_CACHE)
+// Take the samples due in the `nr` instructions of a block just executed
+// at the instructions where they are due.
+static inline void profiler_block(Decode *ops, int nr) {
+  uint64_t first = g_nr_guest_inst - nr; // executed before the block
+  while (unlikely(g_nr_guest_inst >= g_profile_next)) {
+    uint64_t due = (g_profile_next > first ? g_profile_next : first + 1);
+    profiler_sample(ops[due - first - 1].pc, due);
+  }
+}
+#endif
+
+#ifdef CONFIG_IRINGBUF
+void iringbuf_push(Decode *s);
+void iringbuf_push_block(Decode *ops, int nr);
+void iringbuf_dump();
+#endif
+
+#ifdef CONFIG_BTRACE
+extern bool g_btrace_mem_valid;
+void btrace_inst(Decode *s);
+void btrace_flush();
+#endif
+
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IRINGBUF)
+// Format an instruction as "pc: bytes  assembly". This calls the
+// disassembler, so it is only done when the text is really needed.
+void itrace_format(char *buf, int size, vaddr_t pc, uint8_t *inst, int ilen) {
+  char *p = buf;
+  p += snprintf(p, size, FMT_WORD ":", pc);
+  int i;
+#ifdef CONFIG_ISA_x86
+  for (i = 0; i < ilen; i ++) {
+#else
+  for (i = ilen - 1; i >= 0; i --) {
+#endif
+    p += snprintf(p, 4, " %02x", inst[i]);
+  }
+  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
+  int space_len = ilen_max - ilen;
+  if (space_len < 0) space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+
+  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+  disassemble(p, buf + size - p, MUXDEF(CONFIG_ISA_x86, pc + ilen, pc), inst, ilen);
+}
+#endif
+
+#ifdef CONFIG_ITRACE
+bool log_enable();
+
+static const char* itrace_str(Decode *s) {
+  static HART_LOCAL char logbuf[128]; // the harts trace in their own threads
+  itrace_format(logbuf, sizeof(logbuf), s->pc, (uint8_t *)&s->isa.inst, s->snpc - s->pc);
+  return logbuf;
+}
+#endif
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+  IFDEF(CONFIG_IRINGBUF, iringbuf_push(_this));
+  IFDEF(CONFIG_BTRACE, btrace_inst(_this));
 #ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
+  if (ITRACE_COND && log_enable()) { log_write("%s\n", itrace_str(_this)); }
 #endif
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
+  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(itrace_str(_this))); }
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
 #ifdef CONFIG_WATCHPOINT
   for (int i = 0; i < NR_WP; i++)
@@ -73,55 +171,252 @@ static void exec_once(Decode *s, vaddr_t pc) {
   s->snpc = pc;
   isa_exec_once(s);
   cpu.pc = s->dnpc;
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
-  int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst;
-#ifdef CONFIG_ISA_x86
-  for (i = 0; i < ilen; i ++) {
-#else
-  for (i = ilen - 1; i >= 0; i --) {
+}
+
+#ifdef CONFIG_BLOCK_CACHE
+// Guest instructions executed and blocks promoted in each tier. The
+// instructions in cached blocks are not counted to keep that path short.
+static uint64_t nr_interp_inst = 0;
+static uint64_t nr_block_cached = 0;
+#ifdef CONFIG_ENGINE_JIT
+static uint64_t nr_native_inst = 0;
+static uint64_t nr_block_compiled = 0;
 #endif
-    p += snprintf(p, 4, " %02x", inst[i]);
+
+/* Interpret instructions from cpu.pc one by one until the first control
+ * transfer. If `b` is not NULL, they are recorded into it. A block cut
+ * short by `n` or by a stopped machine is not cached.
+ */
+static int interpret_block(uint64_t n, Block *b) {
+  Decode tmp;
+  bool end = false;
+  int i = 0;
+  while (true) {
+    Decode *s = (b != NULL ? &b->ops[i] : &tmp);
+    i ++;
+    IFDEF(CONFIG_TRACE, if (unlikely(g_trace_filter)) trace_block(cpu.pc, cpu.pc));
+    exec_once(s, cpu.pc);
+    g_nr_guest_inst ++;
+    trace_and_difftest(s, cpu.pc);
+    IFDEF(TRACE_CONTROL, trace_control(s));
+    end = (s->dnpc != s->snpc || isa_block_end(s) || i == BLOCK_MAX_INST);
+    if (end || i == n || nemu_state.state != NEMU_RUNNING) break;
   }
-  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
-  int space_len = ilen_max - ilen;
-  if (space_len < 0) space_len = 0;
-  space_len = space_len * 3 + 1;
-  memset(p, ' ', space_len);
-  p += space_len;
+  if (b != NULL && end && decode_cacheable(b->pc)) {
+    block_commit(b, i);
+    nr_block_cached ++;
+  }
+  nr_interp_inst += i;
+  return i;
+}
 
-  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst, ilen);
+bool block_trace(Decode *s, vaddr_t dnpc) {
+  cpu.pc = dnpc;
+  g_nr_guest_inst ++;
+  trace_and_difftest(s, dnpc);
+  IFDEF(TRACE_CONTROL, trace_control(s));
+  return dnpc == s->snpc && nemu_state.state == NEMU_RUNNING;
+}
+
+// Cold code is interpreted, warm code is cached as pre-decoded blocks,
+// and hot blocks are compiled into native code.
+static int exec_block(uint64_t n) {
+  Block *b = block_lookup(cpu.pc);
+  if (b == NULL) return interpret_block(n, block_warm(cpu.pc) ? block_new(cpu.pc) : NULL);
+
+  int nr = (n < b->nr_inst ? n : b->nr_inst);
+  IFDEF(CONFIG_TRACE, if (unlikely(g_trace_filter)) trace_block(b->pc, b->ops[nr - 1].pc));
+#ifdef CONFIG_ENGINE_JIT
+  if (b->native == NULL && ++ b->nr_exec == CONFIG_JIT_HOT_THRESHOLD) {
+    IFDEF(CONFIG_PERF_COUNTER, uint64_t start = get_time());
+    jit_compile(b);
+    IFDEF(CONFIG_PERF_COUNTER, g_perf_time[PERF_TIME_JIT] += get_time() - start);
+    if (b->native != NULL) nr_block_compiled ++;
+  }
+  if (b->native != NULL && nr == b->nr_inst) {
+    nr = b->native();
+    IFNDEF(BLOCK_TRACE, g_nr_guest_inst += nr);
+    IFDEF(CONFIG_IRINGBUF, IFNDEF(BLOCK_TRACE, iringbuf_push_block(b->ops, nr)));
+    IFDEF(CONFIG_PROFILER, IFNDEF(BLOCK_TRACE, profiler_block(b->ops, nr)));
+    IFDEF(TRACE_CONTROL, IFNDEF(BLOCK_TRACE, trace_control(&b->ops[nr - 1])));
+    nr_native_inst += nr;
+    return nr;
+  }
+#endif
+#ifdef BLOCK_TRACE
+  int i;
+  for (i = 0; i < nr; i ++) {
+    Decode *s = &b->ops[i];
+    isa_exec_block(s, 1);
+    if (!block_trace(s, s->dnpc)) return i + 1;
+  }
+  return nr;
+#else
+  nr = isa_exec_block(b->ops, nr);
+  cpu.pc = b->ops[nr - 1].dnpc;
+  g_nr_guest_inst += nr;
+  IFDEF(CONFIG_IRINGBUF, iringbuf_push_block(b->ops, nr));
+  IFDEF(CONFIG_PROFILER, profiler_block(b->ops, nr));
+  IFDEF(TRACE_CONTROL, trace_control(&b->ops[nr - 1]));
+  return nr;
 #endif
 }
 
+static void execute(uint64_t n) {
+  while (n > 0) {
+    IFDEF(CONFIG_SIMPOINT_PROFILE, vaddr_t pc = cpu.pc);
+    int nr = exec_block(n);
+    n -= nr;
+    IFDEF(CONFIG_SIMPOINT_PROFILE, simpoint_block(pc, nr));
+    if (nemu_state.state != NEMU_RUNNING) break;
+    IFDEF(CONFIG_DEVICE, device_update());
+  }
+}
+#else
 static void execute(uint64_t n) {
   Decode s;
   for (;n > 0; n --) {
+    // there are no blocks, so every instruction is checked
+    IFDEF(CONFIG_TRACE, if (unlikely(g_trace_filter)) trace_block(cpu.pc, cpu.pc));
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
+    IFDEF(CONFIG_SIMPOINT_PROFILE, simpoint_inst(&s));
+    IFDEF(TRACE_CONTROL, trace_control(&s));
     if (nemu_state.state != NEMU_RUNNING) break;
     IFDEF(CONFIG_DEVICE, device_update());
   }
 }
+#endif
+
+#ifdef CONFIG_SMP
+#include <pthread.h>
+
+/* Hart 0 runs in the main thread, which also updates the devices. Each of
+ * the other harts runs in its own thread, which is woken up by cpu_exec()
+ * and parks again after the same `n` instructions as hart 0, or when the
+ * machine stops. cpu_exec() returns when all the harts are parked.
+ */
+static pthread_mutex_t hart_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hart_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t hart_epoch = 0; // increased every time the harts are woken up
+static uint64_t hart_budget = 0; // instructions for each hart to execute
+static int nr_hart_running = 0;
+static uint64_t hart_nr_inst[CONFIG_NR_HART] = {};
+
+static void* hart_main(void *arg) {
+  int id = (intptr_t)arg;
+  uint64_t epoch = 0;
+  Decode s;
+  isa_hart_init(id);
+  while (true) {
+    pthread_mutex_lock(&hart_lock);
+    while (hart_epoch == epoch) pthread_cond_wait(&hart_cond, &hart_lock);
+    epoch = hart_epoch;
+    pthread_mutex_unlock(&hart_lock);
+
+    uint64_t n = 0;
+    while (n < hart_budget && nemu_state.state == NEMU_RUNNING) {
+      exec_once(&s, cpu.pc);
+      n ++;
+      trace_and_difftest(&s, cpu.pc);
+    }
+
+    pthread_mutex_lock(&hart_lock);
+    hart_nr_inst[id] += n;
+    nr_hart_running --;
+    pthread_cond_broadcast(&hart_cond);
+    pthread_mutex_unlock(&hart_lock);
+  }
+  return NULL;
+}
+
+static void smp_start(uint64_t n) {
+  static bool created = false;
+  if (!created) {
+    for (intptr_t i = 1; i < CONFIG_NR_HART; i ++) {
+      pthread_t t;
+      int ret = pthread_create(&t, NULL, hart_main, (void *)i);
+      Assert(ret == 0, "cannot create the thread of hart %d", (int)i);
+      pthread_detach(t);
+    }
+    created = true;
+  }
+  pthread_mutex_lock(&hart_lock);
+  hart_budget = n;
+  nr_hart_running = CONFIG_NR_HART - 1;
+  hart_epoch ++;
+  pthread_cond_broadcast(&hart_cond);
+  pthread_mutex_unlock(&hart_lock);
+}
+
+static void smp_stop() {
+  pthread_mutex_lock(&hart_lock);
+  while (nr_hart_running > 0) pthread_cond_wait(&hart_cond, &hart_lock);
+  pthread_mutex_unlock(&hart_lock);
+}
+#endif
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
-  Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
-  if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
+  uint64_t nr_inst = g_nr_guest_inst;
+#ifdef CONFIG_SMP
+  hart_nr_inst[0] = g_nr_guest_inst;
+  for (int i = 1; i < CONFIG_NR_HART; i ++) nr_inst += hart_nr_inst[i];
+  for (int i = 0; i < CONFIG_NR_HART; i ++) {
+    Log("guest instructions on hart %d = " NUMBERIC_FMT, i, hart_nr_inst[i]);
+  }
+#endif
+  Log("total guest instructions = " NUMBERIC_FMT, nr_inst);
+  if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", nr_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+#ifdef CONFIG_BLOCK_CACHE
+  uint64_t nr_block_inst = g_nr_guest_inst - nr_interp_inst - MUXDEF(CONFIG_ENGINE_JIT, nr_native_inst, 0);
+  Log("guest instructions interpreted = " NUMBERIC_FMT ", in cached blocks = " NUMBERIC_FMT
+      IFDEF(CONFIG_ENGINE_JIT, ", in native code = " NUMBERIC_FMT),
+      nr_interp_inst, nr_block_inst IFDEF(CONFIG_ENGINE_JIT, , nr_native_inst));
+  Log("blocks cached = " NUMBERIC_FMT IFDEF(CONFIG_ENGINE_JIT, ", compiled = " NUMBERIC_FMT),
+      nr_block_cached IFDEF(CONFIG_ENGINE_JIT, , nr_block_compiled));
+#endif
+  IFDEF(CONFIG_IDLE_FAST_FORWARD, Log("guest instructions skipped in idle loops = " NUMBERIC_FMT, get_icount_skipped()));
+  IFDEF(CONFIG_INSTPAT_PROFILE, instpat_profile_dump());
+  IFDEF(CONFIG_SIMPOINT_PROFILE, simpoint_dump());
+  IFDEF(CONFIG_PROFILER, profiler_dump());
+  IFDEF(CONFIG_BTRACE, btrace_flush());
+  IFDEF(CONFIG_PERF_COUNTER, perf_statistic());
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IRINGBUF)
+  void disasm_statistic();
+  disasm_statistic();
+#endif
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_IRINGBUF, iringbuf_dump());
   isa_reg_display();
+  IFDEF(CONFIG_FTRACE, ftrace_flush());
   statistic();
+  IFDEF(CONFIG_LOG_ASYNC, log_flush());
+}
+
+/* Execute until cpu.pc reaches `pc` or the machine stops. This runs one
+ * instruction at a time, so it is only meant to reach a point once, e.g.
+ * where the fork server takes over.
+ */
+void cpu_exec_until(vaddr_t pc) {
+  g_print_step = false;
+  switch (nemu_state.state) {
+    case NEMU_END: case NEMU_ABORT: case NEMU_QUIT: return;
+    default: nemu_state.state = NEMU_RUNNING;
+  }
+
+  uint64_t timer_start = get_time();
+  while (cpu.pc != pc && nemu_state.state == NEMU_RUNNING) execute(1);
+  g_timer += get_time() - timer_start;
+  IFDEF(CONFIG_PERF_COUNTER, g_perf_time[PERF_TIME_EXEC] = g_timer);
+
+  if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
 }
 
 /* Simulate how the CPU works. */
@@ -136,10 +431,15 @@ void cpu_exec(uint64_t n) {
 
   uint64_t timer_start = get_time();
 
+  // forget the memory accessed by the monitor, e.g. `x` of sdb
+  IFDEF(CONFIG_BTRACE, g_btrace_mem_valid = false);
+  IFDEF(CONFIG_SMP, smp_start(n));
   execute(n);
+  IFDEF(CONFIG_SMP, smp_stop());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
+  IFDEF(CONFIG_PERF_COUNTER, g_perf_time[PERF_TIME_EXEC] = g_timer);
 
   switch (nemu_state.state) {
     case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break;
@@ -150,6 +450,8 @@ void cpu_exec(uint64_t n) {
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
             ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
           nemu_state.halt_pc);
+      IFDEF(CONFIG_IRINGBUF, if (nemu_state.state == NEMU_ABORT || nemu_state.halt_ret != 0) iringbuf_dump());
+      IFDEF(CONFIG_FTRACE, if (nemu_state.state == NEMU_ABORT) ftrace_flush());
       // fall through
     case NEMU_QUIT: statistic();
   }
@@ -0,0 +1,78 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#define NR_DCACHE CONFIG_DECODE_CACHE_SIZE
+static_assert((NR_DCACHE & (NR_DCACHE - 1)) == 0, "decode cache size should be a power of 2");
+
+typedef struct {
+  vaddr_t pc;
+  vaddr_t snpc;
+  const void *handler;
+  ISADecodeInfo isa;
+} DecodeCacheEntry;
+
+static MACHINE_LOCAL DecodeCacheEntry dcache[NR_DCACHE] = {};
+
+static inline DecodeCacheEntry* dcache_entry(vaddr_t pc) {
+  return &dcache[(pc >> 2) & (NR_DCACHE - 1)];
+}
+
+// only instructions from pmem with an identical mapping are cached,
+// since invalidation is driven by stores to physical pages
+bool decode_cacheable(vaddr_t pc) {
+  return isa_mmu_check(pc, 4, MEM_TYPE_IFETCH) == MMU_DIRECT && in_pmem(pc);
+}
+
+bool decode_cache_fetch(Decode *s) {
+  DecodeCacheEntry *e = dcache_entry(s->pc);
+  if (likely(e->handler != NULL && e->pc == s->pc)) {
+    s->snpc = e->snpc;
+    s->isa = e->isa;
+    s->handler = e->handler;
+    return true;
+  }
+  s->handler = NULL;
+  return false;
+}
+
+void decode_cache_fill(Decode *s, const void *handler) {
+  s->handler = handler;
+  if (!decode_cacheable(s->pc)) return;
+  DecodeCacheEntry *e = dcache_entry(s->pc);
+  e->pc = s->pc;
+  e->snpc = s->snpc;
+  e->handler = handler;
+  e->isa = s->isa;
+  pmem_mark_code(s->pc);
+}
+
+// The operands are extracted after the entry is filled, so copy them in.
+void decode_cache_update(Decode *s) {
+  DecodeCacheEntry *e = dcache_entry(s->pc);
+  if (e->pc == s->pc && e->handler == s->handler) e->isa = s->isa;
+}
+
+void decode_cache_flush_page(paddr_t addr) {
+  vaddr_t page = addr & ~PAGE_MASK;
+  vaddr_t pc;
+  for (pc = page; pc < page + PAGE_SIZE; pc += 4) {
+    DecodeCacheEntry *e = dcache_entry(pc);
+    if (e->handler != NULL && (e->pc & ~PAGE_MASK) == page) { e->handler = NULL; }
+  }
+}
@@ -0,0 +1,50 @@
+#***************************************************************************************
+# Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+ifndef CONFIG_DECODE_CACHE
+SRCS-BLACKLIST-y += src/cpu/decode-cache.c
+endif
+
+ifndef CONFIG_INSTPAT_PROFILE
+SRCS-BLACKLIST-y += src/cpu/instpat-profile.c
+endif
+
+ifndef CONFIG_SIMPOINT_PROFILE
+SRCS-BLACKLIST-y += src/cpu/simpoint.c
+endif
+
+ifndef CONFIG_PROFILER
+SRCS-BLACKLIST-y += src/cpu/profiler.c
+endif
+
+ifndef CONFIG_IRINGBUF
+SRCS-BLACKLIST-y += src/cpu/iringbuf.c
+endif
+
+ifndef CONFIG_BTRACE
+SRCS-BLACKLIST-y += src/cpu/btrace.c
+endif
+
+ifndef CONFIG_FTRACE
+SRCS-BLACKLIST-y += src/cpu/ftrace.c
+endif
+
+ifndef CONFIG_PERF_COUNTER
+SRCS-BLACKLIST-y += src/cpu/perf.c
+endif
+
+ifdef CONFIG_SMP
+LIBS += -lpthread
+endif
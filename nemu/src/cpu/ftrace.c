@@ -0,0 +1,86 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+
+/* The function tracer records every call and return into a ring buffer of
+ * fixed-size binary events, which only costs a few stores. The names of
+ * the functions are looked up when the ring is dumped, that is, when the
+ * machine aborts or on the `ftrace` command of sdb.
+ */
+
+#define NR_EVENT CONFIG_FTRACE_RING_SIZE
+static_assert((NR_EVENT & (NR_EVENT - 1)) == 0, "size of the ftrace ring should be a power of 2");
+
+typedef struct {
+  uint64_t nr_inst; // instructions executed before the event
+  uint64_t pc;
+  uint64_t target;
+  uint32_t depth;   // depth of the caller
+  uint32_t kind;    // JUMP_CALL or JUMP_RET
+} FtraceEvent;
+
+extern MACHINE_LOCAL uint64_t g_nr_guest_inst;
+
+static FtraceEvent ring[NR_EVENT];
+static uint64_t nr_event = 0; // events recorded so far, the older ones are overwritten
+static uint32_t depth = 0;
+
+void ftrace_jump(int kind, vaddr_t pc, vaddr_t target) {
+  if (kind == JUMP_RET && depth > 0) depth --;
+  FtraceEvent *e = &ring[nr_event ++ & (NR_EVENT - 1)];
+  e->nr_inst = g_nr_guest_inst;
+  e->pc = pc;
+  e->target = target;
+  e->depth = depth;
+  e->kind = kind;
+  if (kind == JUMP_CALL) depth ++;
+}
+
+static void event_name(char *buf, size_t size, vaddr_t addr) {
+  vaddr_t start;
+  const char *name = symbol_find(addr, &start);
+  if (name == NULL) snprintf(buf, size, "??");
+  else if (start == addr) snprintf(buf, size, "%s", name);
+  else snprintf(buf, size, "%s+0x%x", name, (uint32_t)(addr - start));
+}
+
+// print the events in the ring from the oldest one
+void ftrace_dump(FILE *fp) {
+  uint64_t first = (nr_event > NR_EVENT ? nr_event - NR_EVENT : 0);
+  fprintf(fp, "ftrace: the last %" PRIu64 " of %" PRIu64 " calls and returns\n", nr_event - first, nr_event);
+  for (uint64_t i = first; i < nr_event; i ++) {
+    FtraceEvent *e = &ring[i & (NR_EVENT - 1)];
+    char name[64];
+    bool call = (e->kind == JUMP_CALL);
+    event_name(name, sizeof(name), call ? e->target : e->pc);
+    int indent = (e->depth < 64 ? e->depth : 64);
+    fprintf(fp, "%12" PRIu64 " " FMT_WORD ": %*s%s [%s@" FMT_WORD "]\n", e->nr_inst, (word_t)e->pc,
+        indent * 2, "", (call ? "call" : "ret "), name, (word_t)(call ? e->target : e->pc));
+  }
+}
+
+void ftrace_flush() {
+  if (nr_event == 0) return;
+  FILE *fp = fopen(CONFIG_FTRACE_FILE, "w");
+  if (fp == NULL) {
+    Log("Can not write the function trace to %s", CONFIG_FTRACE_FILE);
+    return;
+  }
+  ftrace_dump(fp);
+  fclose(fp);
+  Log("The last calls and returns are saved to %s", CONFIG_FTRACE_FILE);
+}
@@ -0,0 +1,64 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+static InstpatCounter *head = NULL;
+static int nr_counter = 0;
+
+void instpat_profile_register(InstpatCounter *c) {
+  c->next = head;
+  head = c;
+  nr_counter ++;
+}
+
+static int cmp_count(const void *a, const void *b) {
+  uint64_t x = (*(InstpatCounter **)a)->count, y = (*(InstpatCounter **)b)->count;
+  return (x < y) - (x > y);
+}
+
+// Print the patterns by their match counts, and save them for
+// `make instpat-sort`, which reorders INSTPAT() by the counts.
+void instpat_profile_dump() {
+  if (nr_counter == 0) return;
+  InstpatCounter **list = malloc(sizeof(*list) * nr_counter);
+  InstpatCounter *c;
+  uint64_t total = 0;
+  int i = 0;
+  for (c = head; c != NULL; c = c->next) {
+    list[i ++] = c;
+    total += c->count;
+  }
+  qsort(list, nr_counter, sizeof(*list), cmp_count);
+
+  Log("INSTPAT matches (total = %" PRIu64 "):", total);
+  for (i = 0; i < nr_counter; i ++) {
+    Log("%6.2f%% %12" PRIu64 " %-10s line %d", list[i]->count * 100.0 / total,
+        list[i]->count, list[i]->name, list[i]->line);
+  }
+
+  FILE *fp = fopen(CONFIG_INSTPAT_PROFILE_FILE, "w");
+  if (fp == NULL) {
+    Log("Can not write the INSTPAT profile to %s", CONFIG_INSTPAT_PROFILE_FILE);
+  } else {
+    for (i = 0; i < nr_counter; i ++) {
+      fprintf(fp, "%d %" PRIu64 " %s \"%s\"\n", list[i]->line, list[i]->count,
+          list[i]->name, list[i]->pattern);
+    }
+    fclose(fp);
+    Log("INSTPAT profile is saved to %s", CONFIG_INSTPAT_PROFILE_FILE);
+  }
+  free(list);
+}
@@ -0,0 +1,61 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/decode.h>
+
+/* The instruction ring buffer only keeps the pc and the bytes of the last
+ * instructions executed. They are disassembled when the ring is dumped, so
+ * the tracer costs a few stores per instruction.
+ */
+
+#define NR_ENTRY CONFIG_IRINGBUF_SIZE
+static_assert((NR_ENTRY & (NR_ENTRY - 1)) == 0, "size of the instruction ring should be a power of 2");
+
+typedef struct {
+  vaddr_t pc;
+  uint32_t ilen;
+  uint8_t inst[sizeof(((Decode *)0)->isa.inst)];
+} IRingEntry;
+
+static IRingEntry ring[NR_ENTRY];
+static uint64_t nr_entry = 0;
+
+void itrace_format(char *buf, int size, vaddr_t pc, uint8_t *inst, int ilen);
+
+void iringbuf_push(Decode *s) {
+  IRingEntry *e = &ring[nr_entry ++ & (NR_ENTRY - 1)];
+  e->pc = s->pc;
+  e->ilen = s->snpc - s->pc;
+  memcpy(e->inst, &s->isa.inst, sizeof(e->inst));
+}
+
+void iringbuf_push_block(Decode *ops, int nr) {
+  for (int i = 0; i < nr; i ++) iringbuf_push(&ops[i]);
+}
+
+// print the ring from the oldest instruction, and point at the last one
+void iringbuf_dump() {
+  if (nr_entry == 0) return;
+  uint64_t first = (nr_entry > NR_ENTRY ? nr_entry - NR_ENTRY : 0);
+  _Log("The last %d instructions executed:\n", (int)(nr_entry - first));
+  for (uint64_t i = first; i < nr_entry; i ++) {
+    IRingEntry *e = &ring[i & (NR_ENTRY - 1)];
+    char buf[128];
+    itrace_format(buf, sizeof(buf), e->pc, e->inst, e->ilen);
+    _Log("%s %s\n", (i == nr_entry - 1 ? "-->" : "   "), buf);
+  }
+}
@@ -0,0 +1,94 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/perf.h>
+#include <device/map.h>
+
+/* The counters are plain increments on the paths of the events. Like the
+ * rest of the state of a machine, they are local to the thread running
+ * it. They are saved as JSON when the machine stops, or by the `stats`
+ * command of sdb.
+ */
+
+MACHINE_LOCAL uint64_t g_perf[NR_PERF_EVENT] = {};
+MACHINE_LOCAL uint64_t g_perf_time[NR_PERF_TIME] = {};
+
+extern MACHINE_LOCAL uint64_t g_nr_guest_inst;
+static MACHINE_LOCAL const char *stats_file = NULL;
+
+static const char *event_name[NR_PERF_EVENT] = {
+  [PERF_LOAD] = "load", [PERF_STORE] = "store", [PERF_AMO] = "amo",
+  [PERF_BRANCH_TAKEN] = "branch_taken", [PERF_BRANCH_NOT_TAKEN] = "branch_not_taken",
+  [PERF_EXCEPTION] = "exception", [PERF_INTR] = "interrupt",
+};
+
+// `execute` includes `device` and `jit`
+static const char *time_name[NR_PERF_TIME] = {
+  [PERF_TIME_INIT] = "init", [PERF_TIME_EXEC] = "execute",
+  [PERF_TIME_DEVICE] = "device", [PERF_TIME_JIT] = "jit",
+};
+
+IOMap* mmio_maps(int *nr);
+
+void init_perf(const char *file) {
+  stats_file = file;
+}
+
+void perf_dump(FILE *fp) {
+  uint64_t exec = g_perf_time[PERF_TIME_EXEC];
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"isa\": \"%s\",\n", str(__GUEST_ISA__));
+  fprintf(fp, "  \"instructions\": %" PRIu64 ",\n", g_nr_guest_inst);
+  fprintf(fp, "  \"frequency\": %" PRIu64 ",\n", (exec > 0 ? g_nr_guest_inst * 1000000 / exec : 0));
+
+  fprintf(fp, "  \"host_time_us\": {\"total\": %" PRIu64, get_time());
+  for (int i = 0; i < NR_PERF_TIME; i ++) fprintf(fp, ", \"%s\": %" PRIu64, time_name[i], g_perf_time[i]);
+  fprintf(fp, "},\n");
+
+  fprintf(fp, "  \"events\": {");
+  for (int i = 0; i < NR_PERF_EVENT; i ++) {
+    fprintf(fp, "%s\"%s\": %" PRIu64, (i == 0 ? "" : ", "), event_name[i], g_perf[i]);
+  }
+  fprintf(fp, "},\n");
+
+  fprintf(fp, "  \"mmio\": {");
+  int nr = 0;
+  IOMap *maps = MUXDEF(CONFIG_DEVICE, mmio_maps(&nr), NULL);
+  for (int i = 0; i < nr; i ++) {
+    fprintf(fp, "%s\n    \"%s\": {\"read\": %" PRIu64 ", \"write\": %" PRIu64 "}",
+        (i == 0 ? "" : ","), maps[i].name, maps[i].nr_read, maps[i].nr_write);
+  }
+  fprintf(fp, "%s}\n", (nr > 0 ? "\n  " : ""));
+  fprintf(fp, "}\n");
+}
+
+bool perf_save(const char *file) {
+  FILE *fp = fopen(file, "w");
+  if (fp == NULL) {
+    printf("Can not write the statistics to %s\n", file);
+    return false;
+  }
+  perf_dump(fp);
+  fclose(fp);
+  return true;
+}
+
+void perf_statistic() {
+  Log("loads = %" PRIu64 ", stores = %" PRIu64 ", branches taken = %" PRIu64 ", not taken = %" PRIu64,
+      g_perf[PERF_LOAD], g_perf[PERF_STORE], g_perf[PERF_BRANCH_TAKEN], g_perf[PERF_BRANCH_NOT_TAKEN]);
+  if (stats_file != NULL && perf_save(stats_file)) Log("Statistics are saved to %s", stats_file);
+}
@@ -0,0 +1,231 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/decode.h>
+
+/* A sampling profiler. The pc is sampled every PROFILER_PERIOD
+ * instructions. In a cached or compiled block, the sample is taken at the
+ * instruction of the block where the period ends, not at its last one, so
+ * the pcs are sampled per instruction on all the engines. Each sample is
+ * counted for its pc and for the stack of functions being called. The
+ * stack is a shadow call stack maintained on the calls and returns
+ * reported by isa_jump_kind(). The flat profile is printed by the
+ * functions of the guest ELF, and the stacks are written to PROFILER_FILE
+ * in the folded format of FlameGraph.
+ */
+
+#define STACK_MAX 256 // deeper frames are counted but not recorded
+
+uint64_t g_profile_next = CONFIG_PROFILER_PERIOD;
+
+static vaddr_t root = 0;        // the function making the first call
+static bool has_root = false;
+static vaddr_t stack[STACK_MAX]; // entries of the functions called
+static int depth = 0;
+
+typedef struct {
+  vaddr_t pc;
+  uint64_t count;
+} PCCount;
+
+typedef struct {
+  uint32_t hash;
+  int nr_frame;
+  vaddr_t *frame; // function entries, from the root to the leaf
+  uint64_t count;
+} StackCount;
+
+// open addressing tables, grown to keep the load factor under 1/2
+static PCCount *pc_table = NULL;
+static uint32_t pc_size = 0, nr_pc = 0;
+static StackCount *stack_table = NULL;
+static uint32_t stack_size = 0, nr_stack = 0;
+static uint64_t nr_sample = 0;
+
+static inline uint32_t hash_pc(vaddr_t pc) {
+  return (uint32_t)((pc >> 1) * 0x9e3779b1u);
+}
+
+static PCCount* pc_slot(PCCount *table, uint32_t size, vaddr_t pc) {
+  uint32_t i;
+  for (i = hash_pc(pc) & (size - 1); table[i].count != 0 && table[i].pc != pc; i = (i + 1) & (size - 1)) ;
+  return &table[i];
+}
+
+static void pc_count(vaddr_t pc) {
+  if ((nr_pc + 1) * 2 > pc_size) {
+    uint32_t size = (pc_size == 0 ? 1024 : pc_size * 2);
+    PCCount *table = calloc(size, sizeof(*table));
+    assert(table);
+    for (uint32_t i = 0; i < pc_size; i ++) {
+      if (pc_table[i].count != 0) *pc_slot(table, size, pc_table[i].pc) = pc_table[i];
+    }
+    free(pc_table);
+    pc_table = table;
+    pc_size = size;
+  }
+  PCCount *c = pc_slot(pc_table, pc_size, pc);
+  if (c->count == 0) { c->pc = pc; nr_pc ++; }
+  c->count ++;
+}
+
+static StackCount* stack_slot(StackCount *table, uint32_t size, uint32_t hash,
+    vaddr_t *frame, int nr_frame) {
+  uint32_t i;
+  for (i = hash & (size - 1); table[i].count != 0; i = (i + 1) & (size - 1)) {
+    StackCount *s = &table[i];
+    if (s->hash == hash && s->nr_frame == nr_frame &&
+        memcmp(s->frame, frame, sizeof(vaddr_t) * nr_frame) == 0) break;
+  }
+  return &table[i];
+}
+
+static void stack_count(vaddr_t leaf) {
+  vaddr_t frame[STACK_MAX + 2];
+  int n = 0;
+  if (has_root) frame[n ++] = root;
+  int d = (depth < STACK_MAX ? depth : STACK_MAX);
+  memcpy(frame + n, stack, sizeof(vaddr_t) * d);
+  n += d;
+  // the leaf is usually the function called last
+  if (n == 0 || frame[n - 1] != leaf) frame[n ++] = leaf;
+  uint32_t hash = 0;
+  for (int i = 0; i < n; i ++) { hash = (hash ^ hash_pc(frame[i])) * 0x01000193u; }
+
+  if ((nr_stack + 1) * 2 > stack_size) {
+    uint32_t size = (stack_size == 0 ? 1024 : stack_size * 2);
+    StackCount *table = calloc(size, sizeof(*table));
+    assert(table);
+    for (uint32_t i = 0; i < stack_size; i ++) {
+      StackCount *s = &stack_table[i];
+      if (s->count != 0) *stack_slot(table, size, s->hash, s->frame, s->nr_frame) = *s;
+    }
+    free(stack_table);
+    stack_table = table;
+    stack_size = size;
+  }
+  StackCount *s = stack_slot(stack_table, stack_size, hash, frame, n);
+  if (s->count == 0) {
+    s->hash = hash;
+    s->nr_frame = n;
+    s->frame = malloc(sizeof(vaddr_t) * n);
+    assert(s->frame);
+    memcpy(s->frame, frame, sizeof(vaddr_t) * n);
+    nr_stack ++;
+  }
+  s->count ++;
+}
+
+// the instruction at `pc` transfers the control to `target`
+void profiler_jump(int kind, vaddr_t pc, vaddr_t target) {
+  switch (kind) {
+    case JUMP_CALL:
+      if (!has_root) {
+        if (symbol_find(pc, &root) == NULL) root = pc;
+        has_root = true;
+      }
+      if (depth < STACK_MAX) stack[depth] = target;
+      depth ++;
+      break;
+    case JUMP_RET:
+      if (depth > 0) depth --;
+      break;
+  }
+}
+
+// `pc` is the `nr_inst`-th instruction executed
+void profiler_sample(vaddr_t pc, uint64_t nr_inst) {
+  g_profile_next = nr_inst + CONFIG_PROFILER_PERIOD;
+  nr_sample ++;
+  pc_count(pc);
+  vaddr_t entry;
+  stack_count(symbol_find(pc, &entry) != NULL ? entry : pc);
+}
+
+static void frame_name(char *buf, size_t size, vaddr_t addr) {
+  const char *name = symbol_find(addr, NULL);
+  if (name != NULL) snprintf(buf, size, "%s", name);
+  else snprintf(buf, size, FMT_WORD, addr);
+}
+
+typedef struct {
+  vaddr_t entry;
+  const char *name;
+  uint64_t count;
+} FuncCount;
+
+static int cmp_count(const void *a, const void *b) {
+  uint64_t x = ((FuncCount *)a)->count, y = ((FuncCount *)b)->count;
+  return (x < y) - (x > y);
+}
+
+static int cmp_entry(const void *a, const void *b) {
+  vaddr_t x = ((FuncCount *)a)->entry, y = ((FuncCount *)b)->entry;
+  return (x > y) - (x < y);
+}
+
+#define NR_FLAT_SHOWN 20
+
+// Print the samples of each function, and save the stacks.
+void profiler_dump() {
+  if (nr_sample == 0) return;
+
+  // samples without a function are counted by their pc
+  FuncCount *f = malloc(sizeof(*f) * nr_pc);
+  assert(f);
+  int n = 0;
+  for (uint32_t i = 0; i < pc_size; i ++) {
+    PCCount *c = &pc_table[i];
+    if (c->count == 0) continue;
+    vaddr_t entry = c->pc;
+    const char *name = symbol_find(c->pc, &entry);
+    f[n ++] = (FuncCount) { .entry = entry, .name = name, .count = c->count };
+  }
+  qsort(f, n, sizeof(*f), cmp_entry);
+  int m = 0;
+  for (int i = 0; i < n; i ++) {
+    if (m > 0 && f[i].name != NULL && f[m - 1].entry == f[i].entry) f[m - 1].count += f[i].count;
+    else f[m ++] = f[i];
+  }
+  qsort(f, m, sizeof(*f), cmp_count);
+
+  Log("Flat profile (%" PRIu64 " samples, one every %d instructions):", nr_sample, CONFIG_PROFILER_PERIOD);
+  for (int i = 0; i < m && i < NR_FLAT_SHOWN; i ++) {
+    char name[64];
+    frame_name(name, sizeof(name), f[i].entry);
+    Log("%6.2f%% %12" PRIu64 " %s", f[i].count * 100.0 / nr_sample, f[i].count, name);
+  }
+  free(f);
+
+  FILE *fp = fopen(CONFIG_PROFILER_FILE, "w");
+  if (fp == NULL) {
+    Log("Can not write the stacks to %s", CONFIG_PROFILER_FILE);
+    return;
+  }
+  for (uint32_t i = 0; i < stack_size; i ++) {
+    StackCount *s = &stack_table[i];
+    if (s->count == 0) continue;
+    for (int j = 0; j < s->nr_frame; j ++) {
+      char name[64];
+      frame_name(name, sizeof(name), s->frame[j]);
+      fprintf(fp, "%s%s", (j == 0 ? "" : ";"), name);
+    }
+    fprintf(fp, " %" PRIu64 "\n", s->count);
+  }
+  fclose(fp);
+  Log("Folded stacks are saved to %s", CONFIG_PROFILER_FILE);
+}
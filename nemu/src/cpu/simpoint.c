@@ -0,0 +1,183 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/decode.h>
+#include <limits.h>
+
+/* SimPoint profiling. The executed instructions are cut into intervals of
+ * SIMPOINT_INTERVAL instructions, and the instructions executed in each
+ * basic block during an interval are written as a line of the .bb file:
+ *   T:<block id>:<count> :<block id>:<count> ...
+ * The ids start from 1. SimPoint clusters the intervals by these vectors
+ * and picks one interval per cluster into a .simpoints file, which lists
+ * "<interval> <cluster>" per line. When it is given, a snapshot is taken at
+ * the start of each picked interval, so it can be simulated on its own.
+ */
+
+typedef struct {
+  vaddr_t pc;
+  uint64_t count; // instructions executed in the current interval
+} BasicBlock;
+
+static FILE *bbv_fp = NULL;
+static BasicBlock *block = NULL; // indexed by id - 1
+static uint32_t *touched = NULL; // ids of the blocks executed in the current interval
+static uint32_t nr_block = 0, nr_touched = 0, block_cap = 0;
+static uint32_t *bb_index = NULL; // hash of pc to id, 0 for an empty slot
+static uint32_t index_size = 0;
+
+static uint64_t interval_inst = 0;
+static uint64_t nr_interval = 0;
+
+static uint64_t *checkpoint = NULL; // sorted intervals to take snapshots at
+static int nr_checkpoint = 0, next_checkpoint = 0;
+static const char *checkpoint_prefix = NULL;
+
+static inline uint32_t hash(vaddr_t pc) {
+  return (uint32_t)((pc >> 1) * 0x9e3779b1u);
+}
+
+static uint32_t* index_slot(vaddr_t pc) {
+  uint32_t mask = index_size - 1;
+  uint32_t i;
+  for (i = hash(pc) & mask; bb_index[i] != 0 && block[bb_index[i] - 1].pc != pc; i = (i + 1) & mask) ;
+  return &bb_index[i];
+}
+
+static void index_grow() {
+  free(bb_index);
+  index_size = (index_size == 0 ? 4096 : index_size * 2);
+  bb_index = calloc(index_size, sizeof(*bb_index));
+  assert(bb_index);
+  for (uint32_t id = 1; id <= nr_block; id ++) { *index_slot(block[id - 1].pc) = id; }
+}
+
+static BasicBlock* block_of(vaddr_t pc) {
+  uint32_t *slot = index_slot(pc);
+  if (likely(*slot != 0)) return &block[*slot - 1];
+
+  if (nr_block == block_cap) {
+    block_cap = (block_cap == 0 ? 1024 : block_cap * 2);
+    block = realloc(block, sizeof(*block) * block_cap);
+    touched = realloc(touched, sizeof(*touched) * block_cap);
+    assert(block && touched);
+  }
+  block[nr_block] = (BasicBlock) { .pc = pc, .count = 0 };
+  *slot = ++ nr_block;
+  // keep the load factor under 1/2
+  if (nr_block * 2 > index_size) { index_grow(); }
+  return &block[nr_block - 1];
+}
+
+bool snapshot_save(const char *file);
+
+static void take_checkpoint() {
+  while (next_checkpoint < nr_checkpoint && checkpoint[next_checkpoint] < nr_interval) next_checkpoint ++;
+  if (next_checkpoint == nr_checkpoint || checkpoint[next_checkpoint] != nr_interval) return;
+  char file[PATH_MAX];
+  snprintf(file, sizeof(file), "%s.%" PRIu64, checkpoint_prefix, nr_interval);
+  bool ok = snapshot_save(file);
+  Assert(ok, "Can not take the checkpoint of interval %" PRIu64, nr_interval);
+  next_checkpoint ++;
+}
+
+static void interval_end() {
+  fputc('T', bbv_fp);
+  for (uint32_t i = 0; i < nr_touched; i ++) {
+    BasicBlock *b = &block[touched[i] - 1];
+    fprintf(bbv_fp, ":%" PRIu32 ":%" PRIu64 " ", touched[i], b->count);
+    b->count = 0;
+  }
+  fputc('\n', bbv_fp);
+  nr_touched = 0;
+  // a block may cross the boundary, so carry its overshoot
+  interval_inst -= CONFIG_SIMPOINT_INTERVAL;
+  nr_interval ++;
+  if (checkpoint_prefix != NULL) take_checkpoint();
+}
+
+void simpoint_block(vaddr_t pc, int nr_inst) {
+  if (bbv_fp == NULL) return;
+  BasicBlock *b = block_of(pc);
+  if (b->count == 0) touched[nr_touched ++] = b - block + 1;
+  b->count += nr_inst;
+  interval_inst += nr_inst;
+  if (interval_inst >= CONFIG_SIMPOINT_INTERVAL) interval_end();
+}
+
+// the interpreter sees the blocks one instruction at a time
+void simpoint_inst(Decode *s) {
+  static MACHINE_LOCAL vaddr_t start = 0;
+  static MACHINE_LOCAL int len = 0;
+  if (len ++ == 0) start = s->pc;
+  if (s->dnpc != s->snpc || isa_block_end(s)) {
+    simpoint_block(start, len);
+    len = 0;
+  }
+}
+
+static int cmp_interval(const void *a, const void *b) {
+  uint64_t x = *(uint64_t *)a, y = *(uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void load_simpoints(const char *file) {
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open '%s'", file);
+  int cap = 16;
+  checkpoint = malloc(sizeof(*checkpoint) * cap);
+  uint64_t interval;
+  int cluster;
+  while (fscanf(fp, "%" SCNu64 " %d", &interval, &cluster) == 2) {
+    if (nr_checkpoint == cap) {
+      cap *= 2;
+      checkpoint = realloc(checkpoint, sizeof(*checkpoint) * cap);
+    }
+    checkpoint[nr_checkpoint ++] = interval;
+  }
+  fclose(fp);
+  qsort(checkpoint, nr_checkpoint, sizeof(*checkpoint), cmp_interval);
+  Log("%d simpoints are read from %s", nr_checkpoint, file);
+}
+
+void init_simpoint(const char *bbv_file, const char *simpoints_file, const char *prefix) {
+  if (bbv_file != NULL) {
+    bbv_fp = fopen(bbv_file, "w");
+    Assert(bbv_fp, "Can not open '%s'", bbv_file);
+    index_grow();
+    Log("Basic block vectors of every %d instructions are written to %s",
+        CONFIG_SIMPOINT_INTERVAL, bbv_file);
+  }
+  if (simpoints_file != NULL) {
+    Assert(bbv_fp != NULL && prefix != NULL, "--simpoints needs --bbv and --checkpoint");
+    load_simpoints(simpoints_file);
+    checkpoint_prefix = prefix;
+    take_checkpoint();
+  }
+}
+
+// flush the last interval, which is usually shorter than the others
+void simpoint_dump() {
+  if (bbv_fp == NULL) return;
+  checkpoint_prefix = NULL;
+  if (interval_inst > 0) {
+    interval_inst = CONFIG_SIMPOINT_INTERVAL;
+    interval_end();
+  }
+  fflush(bbv_fp);
+  Log("%" PRIu64 " intervals with %" PRIu32 " basic blocks are profiled", nr_interval, nr_block);
+}
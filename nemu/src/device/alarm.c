@@ -20,22 +20,29 @@
 
 #define MAX_HANDLER 8
 
-static alarm_handler_t handler[MAX_HANDLER] = {};
-static int idx = 0;
+static MACHINE_LOCAL alarm_handler_t handler[MAX_HANDLER] = {};
+static MACHINE_LOCAL int idx = 0;
 
 void add_alarm_handle(alarm_handler_t h) {
   assert(idx < MAX_HANDLER);
   handler[idx ++] = h;
 }
 
-static void alarm_sig_handler(int signum) {
+void alarm_fire() {
   int i;
   for (i = 0; i < idx; i ++) {
     handler[i]();
   }
 }
 
+static void alarm_sig_handler(int signum) {
+  alarm_fire();
+}
+
 void init_alarm() {
+  // in icount mode, device_update() fires the alarm by the guest time
+  if (ISDEF(CONFIG_TIME_ICOUNT)) return;
+
   struct sigaction s;
   memset(&s, 0, sizeof(s));
   s.sa_handler = alarm_sig_handler;
@@ -16,6 +16,7 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <cpu/perf.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -29,21 +30,80 @@ void init_audio();
 void init_disk();
 void init_sdcard();
 void init_alarm();
+void fini_map();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
-void device_update() {
-  static uint64_t last = 0;
+extern MACHINE_LOCAL uint64_t g_nr_guest_inst;
+
+static MACHINE_LOCAL uint64_t poll_inst = 0;
+
+#ifdef CONFIG_TIME_ICOUNT
+#define ICOUNT_PERIOD (1000000000ull / TIMER_HZ / CONFIG_ICOUNT_NS_PER_INST)
+
+// The period is counted in instructions, and the host clock is never read.
+// `poll_inst` is kept in executed instructions, while the period boundaries
+// are in the guest clock, which also counts the skipped instructions.
+static bool clock_due() {
+  uint64_t icount = get_icount();
+  poll_inst = g_nr_guest_inst + ((icount / ICOUNT_PERIOD + 1) * ICOUNT_PERIOD - icount);
+  IFNDEF(CONFIG_TARGET_AM, alarm_fire());
+  return true;
+}
+
+// The guest is waiting for the time to pass. Nothing can happen before the
+// next period, so move the guest clock there and let device_update() run.
+void device_idle() {
+  if (poll_inst <= g_nr_guest_inst) return;
+  icount_skip(poll_inst - g_nr_guest_inst);
+  poll_inst = g_nr_guest_inst;
+}
+#else
+/* Reading the host clock is costly compared with an instruction, so the
+ * clock is only read when `g_nr_guest_inst` reaches `poll_inst`. The
+ * interval is adapted to the simulation speed measured between two reads,
+ * which aims at POLL_PER_PERIOD reads in every 1/TIMER_HZ second.
+ */
+#define POLL_PER_PERIOD 4
+#define MAX_POLL_INTERVAL (1ull << 24)
+
+static MACHINE_LOCAL uint64_t poll_interval = 1;
+
+static bool clock_due() {
+  static MACHINE_LOCAL uint64_t last_time = 0, last_inst = 0;
   uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
+  uint64_t dt = now - last_time, ninst = g_nr_guest_inst - last_inst;
+  uint64_t target = (dt > 0 ? ninst * (1000000 / TIMER_HZ / POLL_PER_PERIOD) / dt : MAX_POLL_INTERVAL);
+  // grow slowly, since a short `dt` is not accurate, but shrink at once
+  poll_interval = (target > poll_interval * 2 ? poll_interval * 2 : target);
+  if (poll_interval == 0) poll_interval = 1;
+  if (poll_interval > MAX_POLL_INTERVAL) poll_interval = MAX_POLL_INTERVAL;
+  poll_inst = g_nr_guest_inst + poll_interval;
+  last_time = now;
+  last_inst = g_nr_guest_inst;
+
+  static MACHINE_LOCAL uint64_t last = 0;
+  if (now - last < 1000000 / TIMER_HZ) return false;
   last = now;
+  return true;
+}
+#endif
+
+// `g_nr_guest_inst` is set by restoring a snapshot
+void device_sync() {
+  poll_inst = g_nr_guest_inst;
+}
+
+void device_update() {
+  if (likely(g_nr_guest_inst < poll_inst)) return;
+  if (!clock_due()) return;
+  IFDEF(CONFIG_PERF_COUNTER, uint64_t start = get_time());
 
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
-#ifndef CONFIG_TARGET_AM
+// the machines run by the library open no window
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_TARGET_LIB)
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
@@ -64,6 +124,7 @@ void device_update() {
     }
   }
 #endif
+  IFDEF(CONFIG_PERF_COUNTER, g_perf_time[PERF_TIME_DEVICE] += get_time() - start);
 }
 
 void sdl_clear_event_queue() {
@@ -87,3 +148,7 @@ void init_device() {
 
   IFNDEF(CONFIG_TARGET_AM, init_alarm());
 }
+
+void fini_device() {
+  fini_map();
+}
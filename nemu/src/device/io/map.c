@@ -20,8 +20,8 @@
 
 #define IO_SPACE_MAX (32 * 1024 * 1024)
 
-static uint8_t *io_space = NULL;
-static uint8_t *p_space = NULL;
+static MACHINE_LOCAL uint8_t *io_space = NULL;
+static MACHINE_LOCAL uint8_t *p_space = NULL;
 
 uint8_t* new_space(int size) {
   uint8_t *p = p_space;
@@ -32,6 +32,12 @@ uint8_t* new_space(int size) {
   return p;
 }
 
+// all the spaces allocated so far
+uint8_t* map_space(size_t *size) {
+  *size = p_space - io_space;
+  return io_space;
+}
+
 static void check_bound(IOMap *map, paddr_t addr) {
   if (map == NULL) {
     Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
@@ -52,10 +58,16 @@ void init_map() {
   p_space = io_space;
 }
 
+void fini_map() {
+  free(io_space);
+  io_space = p_space = NULL;
+}
+
 word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_PERF_COUNTER, map->nr_read ++);
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
   return ret;
@@ -65,6 +77,7 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_PERF_COUNTER, map->nr_write ++);
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
 }
@@ -18,8 +18,8 @@
 
 #define NR_MAP 16
 
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+static MACHINE_LOCAL IOMap maps[NR_MAP] = {};
+static MACHINE_LOCAL int nr_map = 0;
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
   int mapid = find_mapid_by_addr(maps, nr_map, addr);
@@ -53,11 +53,32 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
   nr_map ++;
 }
 
+IOMap* mmio_maps(int *nr) {
+  *nr = nr_map;
+  return maps;
+}
+
 /* bus interface */
+#ifdef CONFIG_SMP
+#include <pthread.h>
+// the harts access the devices one at a time
+static pthread_mutex_t mmio_lock = PTHREAD_MUTEX_INITIALIZER;
+#define MMIO_LOCK()   pthread_mutex_lock(&mmio_lock)
+#define MMIO_UNLOCK() pthread_mutex_unlock(&mmio_lock)
+#else
+#define MMIO_LOCK()
+#define MMIO_UNLOCK()
+#endif
+
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  MMIO_LOCK();
+  word_t ret = map_read(addr, len, fetch_mmio_map(addr));
+  MMIO_UNLOCK();
+  return ret;
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
+  MMIO_LOCK();
   map_write(addr, len, data, fetch_mmio_map(addr));
+  MMIO_UNLOCK();
 }
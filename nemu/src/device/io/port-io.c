@@ -18,8 +18,8 @@
 #define PORT_IO_SPACE_MAX 65535
 
 #define NR_MAP 16
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+static MACHINE_LOCAL IOMap maps[NR_MAP] = {};
+static MACHINE_LOCAL int nr_map = 0;
 
 /* device interface */
 void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_callback_t callback) {
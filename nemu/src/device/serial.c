@@ -21,7 +21,7 @@
 
 #define CH_OFFSET 0
 
-static uint8_t *serial_base = NULL;
+static MACHINE_LOCAL uint8_t *serial_base = NULL;
 
 
 static void serial_putc(char ch) {
@@ -17,12 +17,48 @@
 #include <device/alarm.h>
 #include <utils.h>
 
-static uint32_t *rtc_port_base = NULL;
+static MACHINE_LOCAL uint32_t *rtc_port_base = NULL;
+
+#ifdef CONFIG_IDLE_FAST_FORWARD
+#include <isa.h>
+
+#define IDLE_MAX_LOOP 64
+#define IDLE_CONFIRM  4
+
+void device_idle();
+
+/* A loop which only reads the RTC until some time has passed does the same
+ * thing in every iteration, so the iterations up to the next device event
+ * are skipped. Such a loop is recognized by the RTC being read again from
+ * the same pc within IDLE_MAX_LOOP instructions, with no store in between,
+ * IDLE_CONFIRM times in a row.
+ */
+static void idle_check() {
+  extern MACHINE_LOCAL uint64_t g_nr_guest_inst, g_nr_paddr_write;
+  static MACHINE_LOCAL vaddr_t last_pc = 0;
+  static MACHINE_LOCAL uint64_t last_inst = 0, last_write = 0;
+  static MACHINE_LOCAL int nr_hit = 0;
+
+  if (cpu.pc == last_pc && g_nr_guest_inst - last_inst <= IDLE_MAX_LOOP &&
+      g_nr_paddr_write == last_write) {
+    if (++ nr_hit >= IDLE_CONFIRM) {
+      device_idle();
+      nr_hit = 0;
+    }
+  } else {
+    nr_hit = 0;
+  }
+  last_pc = cpu.pc;
+  last_inst = g_nr_guest_inst;
+  last_write = g_nr_paddr_write;
+}
+#endif
 
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    IFDEF(CONFIG_IDLE_FAST_FORWARD, idle_check());
+    uint64_t us = get_guest_time();
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
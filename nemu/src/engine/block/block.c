@@ -0,0 +1,157 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/block.h>
+#include <memory/vaddr.h>
+
+#define NR_BLOCK_HASH 4096
+#define NR_IBTC 1024
+#define BLOCK_CACHE_SIZE (CONFIG_BLOCK_CACHE_SIZE * 1024)
+#define BLOCK_SIZE(nr) (sizeof(Block) + (nr) * sizeof(Decode))
+
+static Block *block_hash[NR_BLOCK_HASH] = {};
+// times the uncached code at a PC is entered, shared by PCs with the same hash
+static uint32_t warm_count[NR_BLOCK_HASH] = {};
+static uint8_t block_cache[BLOCK_CACHE_SIZE] __attribute__((aligned(8)));
+static uint8_t *block_top = block_cache;
+
+// indirect branch target cache, for exits which do not fit the links of a block
+static Block *ibtc[NR_IBTC] = {};
+// the block executed last, its exit will be linked to the next block
+static Block *block_last = NULL;
+
+static inline Block** block_bucket(vaddr_t pc) {
+  return &block_hash[(pc >> 2) & (NR_BLOCK_HASH - 1)];
+}
+
+static inline Block** ibtc_entry(vaddr_t pc) {
+  return &ibtc[(pc >> 2) & (NR_IBTC - 1)];
+}
+
+void block_flush_all() {
+  memset(block_hash, 0, sizeof(block_hash));
+  memset(warm_count, 0, sizeof(warm_count));
+  memset(ibtc, 0, sizeof(ibtc));
+  block_top = block_cache;
+  block_last = NULL;
+  IFDEF(CONFIG_ENGINE_JIT, jit_flush());
+}
+
+static void block_unchain_all() {
+  int i;
+  for (i = 0; i < NR_BLOCK_HASH; i ++) {
+    Block *b;
+    for (b = block_hash[i]; b != NULL; b = b->next) {
+      memset(b->link, 0, sizeof(b->link));
+    }
+  }
+  memset(ibtc, 0, sizeof(ibtc));
+  block_last = NULL;
+}
+
+static Block* block_find(vaddr_t pc) {
+  Block **e = ibtc_entry(pc);
+  if (*e != NULL && (*e)->pc == pc) return *e;
+
+  Block *b;
+  for (b = *block_bucket(pc); b != NULL; b = b->next) {
+    if (b->pc == pc) { *e = b; return b; }
+  }
+  return NULL;
+}
+
+static void block_chain(Block *from, Block *to) {
+  int i;
+  for (i = 0; i < ARRLEN(from->link); i ++) {
+    if (from->link[i].b == NULL) {
+      from->link[i].pc = to->pc;
+      from->link[i].b = to;
+      return;
+    }
+  }
+}
+
+// Find the block at `pc`, which is the exit of the block executed last.
+// Direct branches only have a taken and a fall-through exit, so they
+// are resolved by the links of the last block after the first time.
+Block* block_lookup(vaddr_t pc) {
+  Block *from = block_last;
+  Block *b = NULL;
+  if (from != NULL) {
+    if (from->link[0].pc == pc && from->link[0].b != NULL) b = from->link[0].b;
+    else if (from->link[1].pc == pc && from->link[1].b != NULL) b = from->link[1].b;
+  }
+  if (b == NULL) {
+    b = block_find(pc);
+    if (b != NULL && from != NULL) block_chain(from, b);
+  }
+  block_last = b;
+  return b;
+}
+
+// Return whether the code at `pc`, which is not cached yet,
+// has been entered often enough to be recorded as a block.
+bool block_warm(vaddr_t pc) {
+  uint32_t *c = &warm_count[(pc >> 2) & (NR_BLOCK_HASH - 1)];
+  if (*c < CONFIG_BLOCK_WARM_THRESHOLD) (*c) ++;
+  return *c >= CONFIG_BLOCK_WARM_THRESHOLD;
+}
+
+// The returned block has room for BLOCK_MAX_INST instructions,
+// and it is not visible to block_lookup() until block_commit().
+Block* block_new(vaddr_t pc) {
+  if (block_top + BLOCK_SIZE(BLOCK_MAX_INST) > block_cache + BLOCK_CACHE_SIZE) {
+    block_flush_all();
+  }
+  Block *b = (Block *)block_top;
+  b->pc = pc;
+  b->nr_inst = 0;
+  memset(b->link, 0, sizeof(b->link));
+  IFDEF(CONFIG_ENGINE_JIT, b->nr_exec = 0; b->native = NULL);
+  block_last = NULL;
+  return b;
+}
+
+void block_commit(Block *b, int nr_inst) {
+  assert(nr_inst > 0 && nr_inst <= BLOCK_MAX_INST);
+  b->nr_inst = nr_inst;
+  Block **bucket = block_bucket(b->pc);
+  b->next = *bucket;
+  *bucket = b;
+  block_top += ROUNDUP(BLOCK_SIZE(nr_inst), 8);
+  block_last = b;
+}
+
+static bool block_in_page(Block *b, paddr_t page) {
+  vaddr_t last = b->ops[b->nr_inst - 1].pc;
+  return (b->pc & ~PAGE_MASK) == page || (last & ~PAGE_MASK) == page;
+}
+
+// Blocks are unlinked but their storage is kept until the next
+// full flush, so a block being executed stays intact. Since any
+// block may be chained to the removed ones, all links are dropped.
+void block_flush_page(paddr_t addr) {
+  paddr_t page = addr & ~PAGE_MASK;
+  bool removed = false;
+  int i;
+  for (i = 0; i < NR_BLOCK_HASH; i ++) {
+    Block **p = &block_hash[i];
+    while (*p != NULL) {
+      if (block_in_page(*p, page)) { *p = (*p)->next; removed = true; }
+      else { p = &(*p)->next; }
+    }
+  }
+  if (removed) block_unchain_all();
+}
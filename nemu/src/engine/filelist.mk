@@ -15,3 +15,8 @@
 
 INC_PATH += $(NEMU_HOME)/src/engine/$(ENGINE)
 DIRS-y += src/engine/$(ENGINE)
+
+# the block and the JIT engine reuse the host calls and the entry of the
+# interpreter, and the JIT engine runs cold blocks as the block engine
+DIRS-$(CONFIG_BLOCK_CACHE) += src/engine/interpreter
+DIRS-$(CONFIG_ENGINE_JIT) += src/engine/block
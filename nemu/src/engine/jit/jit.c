@@ -0,0 +1,341 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/block.h>
+#include <memory/vaddr.h>
+#include <cpu/perf.h>
+#include <sys/mman.h>
+#include <stddef.h>
+
+#ifndef __x86_64__
+#error "the JIT engine only supports x86-64 hosts"
+#endif
+
+/* Each block is compiled into a function which returns the number of
+ * guest instructions executed, with cpu.pc set to the next PC. Up to 5
+ * frequently used guest registers of a block are kept in callee-saved
+ * host registers, and r15 holds the address of `cpu`. Loads and stores
+ * call back into NEMU.
+ *
+ * Only instructions implemented by isa/riscv32/inst.c are compiled, so
+ * that the compiled code can be checked against the interpreter. The
+ * others, including every control transfer, call back into the
+ * interpreter for that one instruction, which also leaves the block.
+ * A new INSTPAT may get a case in compile_inst() once it is there.
+ */
+
+#define JIT_CACHE_SIZE (CONFIG_JIT_CACHE_SIZE * 1024)
+// upper bound of the code size of an instruction, including an exit
+#define JIT_INST_MAX_SIZE 256
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+static const int host_cached_reg[] = { RBX, RBP, R12, R13, R14 };
+#define NR_CACHED ARRLEN(host_cached_reg)
+#define NR_GPR MUXDEF(CONFIG_RVE, 16, 32)
+
+static uint8_t *code_cache = NULL;
+static uint8_t *code_top = NULL;
+static uint8_t *p = NULL; // where the next byte of code is emitted
+
+// state of the block being compiled
+static int guest2host[32];
+static uint32_t dirty;    // bitmap of cached guest registers which are modified
+
+#define GPR_OFF(i) (offsetof(CPU_state, gpr) + (i) * sizeof(word_t))
+#define PC_OFF     offsetof(CPU_state, pc)
+
+// --- x86-64 encoding ---
+
+static inline void emit8(uint8_t x) { *p ++ = x; }
+static inline void emit32(uint32_t x) { memcpy(p, &x, 4); p += 4; }
+static inline void emit64(uint64_t x) { memcpy(p, &x, 8); p += 8; }
+
+static inline void emit_rex(int w, int reg, int rm) {
+  uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40) emit8(rex);
+}
+
+// op r/m32(rm), r32(reg)
+static void emit_rr(uint8_t op, int rm, int reg) {
+  emit_rex(0, reg, rm);
+  emit8(op);
+  emit8(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op r32(reg), [r15 + off]
+static void emit_rm(uint8_t op, int reg, uint32_t off) {
+  emit_rex(0, reg, R15);
+  emit8(op);
+  emit8(0x80 | ((reg & 7) << 3) | (R15 & 7));
+  emit32(off);
+}
+
+static void emit_mov_imm(int reg, uint32_t imm) {
+  emit_rex(0, 0, reg);
+  emit8(0xb8 + (reg & 7));
+  emit32(imm);
+}
+
+static void emit_mov_imm64(int reg, uint64_t imm) {
+  emit_rex(1, 0, reg);
+  emit8(0xb8 + (reg & 7));
+  emit64(imm);
+}
+
+// group-1 ALU with imm32: /0 add, /1 or, /4 and, /5 sub, /6 xor, /7 cmp
+static void emit_alu_imm(int ext, int reg, uint32_t imm) {
+  emit_rex(0, 0, reg);
+  emit8(0x81);
+  emit8(0xc0 | (ext << 3) | (reg & 7));
+  emit32(imm);
+}
+
+// jcc rel32, return the address of rel32 to patch
+static uint8_t* emit_jcc(int cc) {
+  emit8(0x0f); emit8(0x80 | cc);
+  uint8_t *rel = p;
+  emit32(0);
+  return rel;
+}
+
+static void patch_rel32(uint8_t *rel) {
+  uint32_t off = p - (rel + 4);
+  memcpy(rel, &off, 4);
+}
+
+static void emit_call(void *fn) {
+  emit_mov_imm64(RAX, (uintptr_t)fn);
+  emit8(0xff); emit8(0xd0); // call rax
+}
+
+static void emit_push(int reg) { emit_rex(0, 0, reg); emit8(0x50 + (reg & 7)); }
+static void emit_pop(int reg)  { emit_rex(0, 0, reg); emit8(0x58 + (reg & 7)); }
+
+enum { CC_NE = 0x5 };
+
+// --- guest registers ---
+
+static void load_reg(int host, int r) {
+  if (r == 0) emit_rr(0x31, host, host); // xor host, host
+  else if (guest2host[r] >= 0) { if (guest2host[r] != host) emit_rr(0x89, host, guest2host[r]); }
+  else emit_rm(0x8b, host, GPR_OFF(r));
+}
+
+static void store_reg(int r, int host) {
+  if (r == 0) return;
+  if (guest2host[r] >= 0) {
+    if (guest2host[r] != host) emit_rr(0x89, guest2host[r], host);
+    dirty |= 1u << r;
+  }
+  else emit_rm(0x89, host, GPR_OFF(r));
+}
+
+// write back the modified cached registers before NEMU reads them
+static void spill_regs() {
+  int r;
+  for (r = 1; r < NR_GPR; r ++) {
+    if (dirty & (1u << r)) emit_rm(0x89, guest2host[r], GPR_OFF(r));
+  }
+  dirty = 0;
+}
+
+static void reload_regs() {
+  int r;
+  for (r = 1; r < NR_GPR; r ++) {
+    if (guest2host[r] >= 0) emit_rm(0x8b, guest2host[r], GPR_OFF(r));
+  }
+}
+
+static void alloc_regs(Block *b) {
+  int count[32] = {};
+  int i, k;
+  for (i = 0; i < b->nr_inst; i ++) {
+    uint32_t inst = b->ops[i].isa.inst;
+    count[BITS(inst, 11, 7)] ++;
+    count[BITS(inst, 19, 15)] ++;
+    count[BITS(inst, 24, 20)] ++;
+  }
+  for (i = 0; i < 32; i ++) guest2host[i] = -1;
+  for (k = 0; k < NR_CACHED; k ++) {
+    int best = 0;
+    for (i = 1; i < NR_GPR; i ++) {
+      if (guest2host[i] < 0 && count[i] > count[best]) best = i;
+    }
+    if (best == 0 || count[best] < 2) break;
+    guest2host[best] = host_cached_reg[k];
+  }
+}
+
+// --- block entry and exits ---
+
+enum { EXIT_PC_IMM, EXIT_PC_SET };
+
+static void emit_prologue() {
+  emit_push(RBX); emit_push(RBP); emit_push(R12);
+  emit_push(R13); emit_push(R14); emit_push(R15);
+  emit8(0x48); emit8(0x83); emit8(0xec); emit8(0x08); // sub rsp, 8
+  emit_mov_imm64(R15, (uintptr_t)&cpu);
+  reload_regs();
+}
+
+static void emit_exit(int type, vaddr_t pc, int nr_inst) {
+  uint32_t saved_dirty = dirty;
+  spill_regs();
+  dirty = saved_dirty; // the code after a conditional exit still needs them
+  if (type == EXIT_PC_IMM) { emit_rex(0, 0, R15); emit8(0xc7); emit8(0x87); emit32(PC_OFF); emit32(pc); }
+  emit_mov_imm(RAX, nr_inst);
+  emit8(0x48); emit8(0x83); emit8(0xc4); emit8(0x08); // add rsp, 8
+  emit_pop(R15); emit_pop(R14); emit_pop(R13);
+  emit_pop(R12); emit_pop(RBP); emit_pop(RBX);
+  emit8(0xc3);
+}
+
+// Call block_trace() for an instruction with the next PC in esi,
+// and leave the block if it says so.
+#ifdef BLOCK_TRACE
+static void emit_trace(Decode *s, int nr_inst) {
+  spill_regs();
+  emit_mov_imm64(RDI, (uintptr_t)s);
+  emit_call(block_trace);
+  emit8(0x84); emit8(0xc0); // test al, al
+  uint8_t *go_on = emit_jcc(CC_NE);
+  emit_exit(EXIT_PC_SET, 0, nr_inst);
+  patch_rel32(go_on);
+}
+#endif
+
+// --- helpers called from the compiled code ---
+
+static bool jit_interpret(Decode *s) {
+  cpu.pc = s->pc;
+  isa_exec_block(s, 1);
+#ifdef BLOCK_TRACE
+  return block_trace(s, s->dnpc);
+#else
+  cpu.pc = s->dnpc;
+  return s->dnpc == s->snpc && nemu_state.state == NEMU_RUNNING;
+#endif
+}
+
+static word_t jit_load(vaddr_t addr, int len) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_LOAD] ++);
+  return vaddr_read(addr, len);
+}
+
+static void jit_store(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_STORE] ++);
+  vaddr_write(addr, len, data);
+}
+
+// --- instructions ---
+
+static void compile_interpret(Decode *s, int nr_inst) {
+  spill_regs();
+  emit_mov_imm64(RDI, (uintptr_t)s);
+  emit_call(jit_interpret);
+  reload_regs();
+  emit8(0x84); emit8(0xc0); // test al, al
+  uint8_t *go_on = emit_jcc(CC_NE);
+  emit_exit(EXIT_PC_SET, 0, nr_inst);
+  patch_rel32(go_on);
+}
+
+static void set_pc(vaddr_t pc) {
+  emit_rex(0, 0, R15); emit8(0xc7); emit8(0x87); emit32(PC_OFF); emit32(pc);
+}
+
+// lbu
+static void compile_load(Decode *s, int rd, int rs1, sword_t imm) {
+  spill_regs();
+  set_pc(s->pc);
+  load_reg(RDI, rs1);
+  emit_alu_imm(0, RDI, imm);
+  emit_mov_imm(RSI, 1);
+  emit_call(jit_load);
+  store_reg(rd, RAX);
+}
+
+// sb
+static void compile_store(Decode *s, int rs1, int rs2, sword_t imm) {
+  spill_regs();
+  set_pc(s->pc);
+  load_reg(RDI, rs1);
+  emit_alu_imm(0, RDI, imm);
+  emit_mov_imm(RSI, 1);
+  load_reg(RDX, rs2);
+  emit_call(jit_store);
+}
+
+// Return false if the instruction should be interpreted.
+static bool compile_inst(Decode *s, int nr_inst) {
+  uint32_t i = s->isa.inst;
+  int rd = BITS(i, 11, 7), rs1 = BITS(i, 19, 15), rs2 = BITS(i, 24, 20);
+  int funct3 = BITS(i, 14, 12);
+  sword_t immI = SEXT(BITS(i, 31, 20), 12);
+  sword_t immS = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7);
+  word_t immU = i & ~0xfffu;
+
+  if (rd >= NR_GPR || rs1 >= NR_GPR || rs2 >= NR_GPR) return false;
+  switch (BITS(i, 6, 0)) {
+    case 0x17: emit_mov_imm(RAX, s->pc + immU); store_reg(rd, RAX); break; // auipc
+    case 0x03: if (funct3 != 4) return false; compile_load(s, rd, rs1, immI); break;  // lbu
+    case 0x23: if (funct3 != 0) return false; compile_store(s, rs1, rs2, immS); break; // sb
+    default: return false;
+  }
+  IFDEF(BLOCK_TRACE, emit_mov_imm(RSI, s->snpc); emit_trace(s, nr_inst));
+  return true;
+}
+
+void jit_compile(Block *b) {
+  if (code_cache == NULL) {
+    code_cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(code_cache != MAP_FAILED, "Can not allocate the code cache");
+    code_top = code_cache;
+  }
+  if (code_top + (b->nr_inst + 1) * JIT_INST_MAX_SIZE > code_cache + JIT_CACHE_SIZE) {
+    // `b` is still valid until the next block is created
+    block_flush_all();
+    return;
+  }
+
+  p = code_top;
+  dirty = 0;
+  alloc_regs(b);
+  uint8_t *entry = p;
+  emit_prologue();
+
+  int i;
+  for (i = 0; i < b->nr_inst; i ++) {
+    Decode *s = &b->ops[i];
+    uint8_t *start = p;
+    uint32_t saved_dirty = dirty;
+    if (!compile_inst(s, i + 1)) {
+      p = start;
+      dirty = saved_dirty;
+      compile_interpret(s, i + 1);
+    }
+  }
+  emit_exit(EXIT_PC_IMM, b->ops[b->nr_inst - 1].snpc, b->nr_inst);
+  assert(p <= code_cache + JIT_CACHE_SIZE);
+
+  code_top = (uint8_t *)ROUNDUP(p, 16);
+  b->native = (int (*)(void))entry;
+}
+
+void jit_flush() {
+  code_top = code_cache;
+}
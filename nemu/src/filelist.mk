@@ -18,8 +18,9 @@ DIRS-y += src/cpu src/monitor src/utils
 DIRS-$(CONFIG_MODE_SYSTEM) += src/memory
 DIRS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/sdb
 
-SHARE = $(if $(CONFIG_TARGET_SHARE),1,0)
+SHARE = $(if $(CONFIG_TARGET_SHARE)$(CONFIG_TARGET_LIB),1,0)
 LIBS += $(if $(CONFIG_TARGET_NATIVE_ELF),-lreadline -ldl -pie,)
+LIBS += $(if $(CONFIG_TARGET_LIB),-lreadline -ldl -lpthread,)
 
 ifdef mainargs
 ASFLAGS += -DBIN_PATH=\"$(mainargs)\"
@@ -15,3 +15,30 @@
 
 INC_PATH += $(NEMU_HOME)/src/isa/$(GUEST_ISA)/include
 DIRS-y += src/isa/$(GUEST_ISA)
+
+INSTPAT_TREE_PATH := $(NEMU_HOME)/tools/instpat-tree
+INSTPAT_TREE := $(INSTPAT_TREE_PATH)/build/instpat-tree
+INSTPAT_SRC := src/isa/$(GUEST_ISA)/inst.c
+
+$(INSTPAT_TREE): $(INSTPAT_TREE_PATH)/instpat-tree.c
+	$(Q)$(MAKE) $(silent) -C $(INSTPAT_TREE_PATH)
+
+ifdef CONFIG_INSTPAT_TREE
+INSTPAT_TREE_H := $(NEMU_HOME)/build/gen-$(GUEST_ISA)/instpat-tree.h
+INC_PATH += $(dir $(INSTPAT_TREE_H))
+GENERATED_H += $(INSTPAT_TREE_H)
+
+$(INSTPAT_TREE_H): $(INSTPAT_SRC) $(INSTPAT_TREE)
+	@echo + GEN $@
+	@mkdir -p $(dir $@)
+	@$(INSTPAT_TREE) $< > $@.tmp
+	@mv $@.tmp $@
+endif
+
+# Reorder INSTPAT() by the profile saved by CONFIG_INSTPAT_PROFILE
+instpat-sort: $(INSTPAT_TREE)
+	@$(INSTPAT_TREE) -p $(call remove_quote,$(CONFIG_INSTPAT_PROFILE_FILE)) $(INSTPAT_SRC) > $(INSTPAT_SRC).tmp
+	@mv $(INSTPAT_SRC).tmp $(INSTPAT_SRC)
+	@echo "INSTPAT() in $(INSTPAT_SRC) are reordered"
+
+.PHONY: instpat-sort
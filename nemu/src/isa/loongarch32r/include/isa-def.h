@@ -26,6 +26,10 @@ typedef struct {
 // decode
 typedef struct {
   uint32_t inst;
+  // operands extracted on the first execution, kept by the decode cache
+  bool decoded;
+  uint8_t rd, src1, src2; // register indices
+  word_t imm;
 } loongarch32r_ISADecodeInfo;
 
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
@@ -27,6 +27,10 @@ typedef struct {
 // decode
 typedef struct {
   uint32_t inst;
+  // operands extracted on the first execution, kept by the decode cache
+  bool decoded;
+  uint8_t rd, src1, src2; // register indices
+  word_t imm;
 } mips32_ISADecodeInfo;
 
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
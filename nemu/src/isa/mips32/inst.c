@@ -17,42 +17,67 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/perf.h>
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+
+// the accesses of the guest are counted here rather than in vaddr_*(),
+// which the monitor may call as well
+static inline word_t Mr(vaddr_t addr, int len) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_LOAD] ++);
+  return vaddr_read(addr, len);
+}
+
+static inline void Mw(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_STORE] ++);
+  vaddr_write(addr, len, data);
+}
 
 enum {
   TYPE_I, TYPE_U,
   TYPE_N, // none
 };
 
-#define src1R() do { *src1 = R(rs); } while (0)
-#define src2R() do { *src2 = R(rt); } while (0)
-#define immI() do { *imm = SEXT(BITS(i, 15, 0), 16); } while(0)
-#define immU() do { *imm = BITS(i, 15, 0); } while(0)
+#define src1R() do { s->isa.src1 = rs; } while (0)
+#define src2R() do { s->isa.src2 = rt; } while (0)
+#define immI() do { s->isa.imm = SEXT(BITS(i, 15, 0), 16); } while(0)
+#define immU() do { s->isa.imm = BITS(i, 15, 0); } while(0)
 
-static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
+// The register indices and the immediate are extracted once and kept in
+// `s->isa`. An unused source is $zero, which reads as 0.
+static void decode_operand(Decode *s, int type) {
   uint32_t i = s->isa.inst;
   int rt = BITS(i, 20, 16);
   int rs = BITS(i, 25, 21);
-  *rd = (type == TYPE_U || type == TYPE_I) ? rt : BITS(i, 15, 11);
+  s->isa.rd = (type == TYPE_U || type == TYPE_I) ? rt : BITS(i, 15, 11);
+  s->isa.src1 = s->isa.src2 = 0;
+  s->isa.imm = 0;
   switch (type) {
     case TYPE_I: src1R(); immI(); break;
     case TYPE_U: src1R(); immU(); break;
     case TYPE_N: break;
     default: panic("unsupported type = %d", type);
   }
+  s->isa.decoded = true;
+  IFDEF(CONFIG_DECODE_CACHE, decode_cache_update(s));
 }
 
-static int decode_exec(Decode *s) {
+// Execute up to `n` instructions starting from `s`. More than one instruction
+// is only executed by the block engine, where `s` is an array of pre-decoded
+// instructions, and the execution stops after the first control transfer.
+static Decode* decode_exec(Decode *s, int n) {
+#ifdef CONFIG_BLOCK_CACHE
+next:
+#endif
   s->dnpc = s->snpc;
 
 #define INSTPAT_INST(s) ((s)->isa.inst)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
-  int rd = 0; \
-  word_t src1 = 0, src2 = 0, imm = 0; \
-  decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  if (!s->isa.decoded) decode_operand(s, concat(TYPE_, type)); \
+  int rd __attribute__((unused)) = s->isa.rd; \
+  word_t src1 __attribute__((unused)) = R(s->isa.src1); \
+  word_t src2 __attribute__((unused)) = R(s->isa.src2); \
+  word_t imm __attribute__((unused)) = s->isa.imm; \
   __VA_ARGS__ ; \
 }
 
@@ -67,10 +92,63 @@ static int decode_exec(Decode *s) {
 
   R(0) = 0; // reset $zero to 0
 
-  return 0;
+#ifdef CONFIG_BLOCK_CACHE
+  if (s->dnpc == s->snpc && -- n > 0) {
+    cpu.pc = s->dnpc;
+    s ++;
+    goto next;
+  }
+#endif
+
+  return s;
 }
 
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_DECODE_CACHE
+  if (decode_cache_fetch(s)) { decode_exec(s, 1); return 0; }
+#endif
   s->isa.inst = inst_fetch(&s->snpc, 4);
-  return decode_exec(s);
+  s->isa.decoded = false;
+  decode_exec(s, 1);
+  return 0;
+}
+
+#ifdef CONFIG_BLOCK_CACHE
+int isa_exec_block(Decode *s, int n) {
+  return decode_exec(s, n) - s + 1;
+}
+#endif
+
+#if defined(CONFIG_BLOCK_CACHE) || defined(CONFIG_SIMPOINT_PROFILE)
+// instructions which may transfer control or stop the machine end a block
+bool isa_block_end(Decode *s) {
+  uint32_t i = s->isa.inst;
+  switch (BITS(i, 31, 26)) {
+    case 0x00: // special: jr, jalr, syscall, break
+      switch (BITS(i, 5, 0)) {
+        case 0x08: case 0x09: case 0x0c: case 0x0d: return true;
+        default: return false;
+      }
+    case 0x01: // regimm branches
+    case 0x02: // j
+    case 0x03: // jal
+    case 0x04: case 0x05: case 0x06: case 0x07: // beq, bne, blez, bgtz
+    case 0x10: // cop0: eret
+    case 0x14: case 0x15: case 0x16: case 0x17: // branch likely
+    case 0x1c: // special2: sdbbp
+      return true;
+    default: return false;
+  }
+}
+#endif
+
+#ifdef CONFIG_PERF_COUNTER
+bool isa_is_branch(Decode *s) {
+  switch (BITS(s->isa.inst, 31, 26)) {
+    case 0x01: case 0x04: case 0x05: case 0x06: case 0x07:
+    case 0x14: case 0x15: case 0x16: case 0x17:
+      return true;
+    default: return false;
+  }
 }
+#endif
@@ -34,10 +34,20 @@ static void restart() {
   cpu.gpr[0] = 0;
 }
 
+#ifdef CONFIG_SMP
+/* Every hart starts from the reset vector, with its hart id in $a0 and
+ * the number of harts in $a1. */
+void isa_hart_init(int hartid) {
+  restart();
+  cpu.gpr[10] = hartid;
+  cpu.gpr[11] = CONFIG_NR_HART;
+}
+#endif
+
 void init_isa() {
   /* Load built-in image. */
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
 
   /* Initialize this virtual computer system. */
-  restart();
+  MUXDEF(CONFIG_SMP, isa_hart_init(0), restart());
 }
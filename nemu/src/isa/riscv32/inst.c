@@ -17,44 +17,126 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/perf.h>
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+
+// the accesses of the guest are counted here rather than in vaddr_*(),
+// which the monitor may call as well
+static inline word_t Mr(vaddr_t addr, int len) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_LOAD] ++);
+  return vaddr_read(addr, len);
+}
+
+static inline void Mw(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_STORE] ++);
+  vaddr_write(addr, len, data);
+}
+
+static inline word_t Mamo(vaddr_t addr, int len, word_t (*op)(word_t old, word_t src), word_t src) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_AMO] ++);
+  return vaddr_amo(addr, len, op, src);
+}
+
+static inline bool Mcas(vaddr_t addr, int len, word_t expect, word_t data) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_AMO] ++);
+  return vaddr_cas(addr, len, expect, data);
+}
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_I, TYPE_U, TYPE_S, TYPE_R,
   TYPE_N, // none
 };
 
-#define src1R() do { *src1 = R(rs1); } while (0)
-#define src2R() do { *src2 = R(rs2); } while (0)
-#define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
-#define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
-#define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define src1R() do { s->isa.src1 = rs1; } while (0)
+#define src2R() do { s->isa.src2 = rs2; } while (0)
+#define immI() do { s->isa.imm = SEXT(BITS(i, 31, 20), 12); } while(0)
+#define immU() do { s->isa.imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
+#define immS() do { s->isa.imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
 
-static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
+// The register indices and the immediate are extracted once and kept in
+// `s->isa`. An unused source is $zero, which reads as 0.
+static void decode_operand(Decode *s, int type) {
   uint32_t i = s->isa.inst;
   int rs1 = BITS(i, 19, 15);
   int rs2 = BITS(i, 24, 20);
-  *rd     = BITS(i, 11, 7);
+  s->isa.rd   = BITS(i, 11, 7);
+  s->isa.src1 = s->isa.src2 = 0;
+  s->isa.imm  = 0;
   switch (type) {
     case TYPE_I: src1R();          immI(); break;
     case TYPE_U:                   immU(); break;
     case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_R: src1R(); src2R();         break;
     case TYPE_N: break;
     default: panic("unsupported type = %d", type);
   }
+  s->isa.decoded = true;
+  IFDEF(CONFIG_DECODE_CACHE, decode_cache_update(s));
+}
+
+/* The reservation of LR remembers the value loaded, and SC succeeds only if
+ * the memory still holds it. The check and the store are a single host
+ * atomic operation, since the other harts may run at the same time.
+ */
+static HART_LOCAL struct {
+  vaddr_t addr;
+  word_t val;
+  bool valid;
+} reservation = {};
+
+static word_t lr(vaddr_t addr, int len) {
+  word_t val = Mr(addr, len);
+  reservation.addr = addr;
+  reservation.val = val;
+  reservation.valid = true;
+  return val;
 }
 
-static int decode_exec(Decode *s) {
+static word_t sc(vaddr_t addr, int len, word_t data) {
+  bool ok = reservation.valid && reservation.addr == addr &&
+    Mcas(addr, len, reservation.val, data);
+  reservation.valid = false;
+  return !ok;
+}
+
+static word_t amo_swap(word_t old, word_t src) { return src; }
+static word_t amo_add (word_t old, word_t src) { return old + src; }
+static word_t amo_xor (word_t old, word_t src) { return old ^ src; }
+static word_t amo_and (word_t old, word_t src) { return old & src; }
+static word_t amo_or  (word_t old, word_t src) { return old | src; }
+static word_t amo_minw (word_t old, word_t src) { return (int32_t)old < (int32_t)src ? old : src; }
+static word_t amo_maxw (word_t old, word_t src) { return (int32_t)old > (int32_t)src ? old : src; }
+static word_t amo_minuw(word_t old, word_t src) { return (uint32_t)old < (uint32_t)src ? old : src; }
+static word_t amo_maxuw(word_t old, word_t src) { return (uint32_t)old > (uint32_t)src ? old : src; }
+#ifdef CONFIG_RV64
+static word_t amo_mind (word_t old, word_t src) { return (int64_t)old < (int64_t)src ? old : src; }
+static word_t amo_maxd (word_t old, word_t src) { return (int64_t)old > (int64_t)src ? old : src; }
+static word_t amo_minud(word_t old, word_t src) { return old < src ? old : src; }
+static word_t amo_maxud(word_t old, word_t src) { return old > src ? old : src; }
+#endif
+
+#define LR(len)      R(rd) = SEXT(lr(src1, len), len * 8)
+#define SC(len)      R(rd) = sc(src1, len, src2)
+#define AMO(op, len) R(rd) = SEXT(Mamo(src1, len, op, src2), len * 8)
+#define RV64_ONLY(...) MUXDEF(CONFIG_RV64, __VA_ARGS__, INV(s->pc))
+
+// Execute up to `n` instructions starting from `s`. More than one instruction
+// is only executed by the block engine, where `s` is an array of pre-decoded
+// instructions, and the execution stops after the first control transfer.
+static Decode* decode_exec(Decode *s, int n) {
+#ifdef CONFIG_BLOCK_CACHE
+next:
+#endif
   s->dnpc = s->snpc;
 
 #define INSTPAT_INST(s) ((s)->isa.inst)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
-  int rd = 0; \
-  word_t src1 = 0, src2 = 0, imm = 0; \
-  decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  if (!s->isa.decoded) decode_operand(s, concat(TYPE_, type)); \
+  int rd __attribute__((unused)) = s->isa.rd; \
+  word_t src1 __attribute__((unused)) = R(s->isa.src1); \
+  word_t src2 __attribute__((unused)) = R(s->isa.src2); \
+  word_t imm __attribute__((unused)) = s->isa.imm; \
   __VA_ARGS__ ; \
 }
 
@@ -63,16 +145,105 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
 
+  INSTPAT("00010?? 00000 ????? 010 ????? 01011 11", lr.w     , R, LR(4));
+  INSTPAT("00011?? ????? ????? 010 ????? 01011 11", sc.w     , R, SC(4));
+  INSTPAT("00001?? ????? ????? 010 ????? 01011 11", amoswap.w, R, AMO(amo_swap, 4));
+  INSTPAT("00000?? ????? ????? 010 ????? 01011 11", amoadd.w , R, AMO(amo_add, 4));
+  INSTPAT("00100?? ????? ????? 010 ????? 01011 11", amoxor.w , R, AMO(amo_xor, 4));
+  INSTPAT("01100?? ????? ????? 010 ????? 01011 11", amoand.w , R, AMO(amo_and, 4));
+  INSTPAT("01000?? ????? ????? 010 ????? 01011 11", amoor.w  , R, AMO(amo_or, 4));
+  INSTPAT("10000?? ????? ????? 010 ????? 01011 11", amomin.w , R, AMO(amo_minw, 4));
+  INSTPAT("10100?? ????? ????? 010 ????? 01011 11", amomax.w , R, AMO(amo_maxw, 4));
+  INSTPAT("11000?? ????? ????? 010 ????? 01011 11", amominu.w, R, AMO(amo_minuw, 4));
+  INSTPAT("11100?? ????? ????? 010 ????? 01011 11", amomaxu.w, R, AMO(amo_maxuw, 4));
+  INSTPAT("00010?? 00000 ????? 011 ????? 01011 11", lr.d     , R, RV64_ONLY(LR(8)));
+  INSTPAT("00011?? ????? ????? 011 ????? 01011 11", sc.d     , R, RV64_ONLY(SC(8)));
+  INSTPAT("00001?? ????? ????? 011 ????? 01011 11", amoswap.d, R, RV64_ONLY(AMO(amo_swap, 8)));
+  INSTPAT("00000?? ????? ????? 011 ????? 01011 11", amoadd.d , R, RV64_ONLY(AMO(amo_add, 8)));
+  INSTPAT("00100?? ????? ????? 011 ????? 01011 11", amoxor.d , R, RV64_ONLY(AMO(amo_xor, 8)));
+  INSTPAT("01100?? ????? ????? 011 ????? 01011 11", amoand.d , R, RV64_ONLY(AMO(amo_and, 8)));
+  INSTPAT("01000?? ????? ????? 011 ????? 01011 11", amoor.d  , R, RV64_ONLY(AMO(amo_or, 8)));
+  INSTPAT("10000?? ????? ????? 011 ????? 01011 11", amomin.d , R, RV64_ONLY(AMO(amo_mind, 8)));
+  INSTPAT("10100?? ????? ????? 011 ????? 01011 11", amomax.d , R, RV64_ONLY(AMO(amo_maxd, 8)));
+  INSTPAT("11000?? ????? ????? 011 ????? 01011 11", amominu.d, R, RV64_ONLY(AMO(amo_minud, 8)));
+  INSTPAT("11100?? ????? ????? 011 ????? 01011 11", amomaxu.d, R, RV64_ONLY(AMO(amo_maxud, 8)));
+
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
   R(0) = 0; // reset $zero to 0
 
-  return 0;
+#ifdef CONFIG_BLOCK_CACHE
+  if (s->dnpc == s->snpc && -- n > 0) {
+    cpu.pc = s->dnpc;
+    s ++;
+    goto next;
+  }
+#endif
+
+  return s;
 }
 
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_DECODE_CACHE
+  if (decode_cache_fetch(s)) { decode_exec(s, 1); return 0; }
+#endif
   s->isa.inst = inst_fetch(&s->snpc, 4);
-  return decode_exec(s);
+  s->isa.decoded = false;
+  decode_exec(s, 1);
+  return 0;
+}
+
+#ifdef CONFIG_BLOCK_CACHE
+int isa_exec_block(Decode *s, int n) {
+  return decode_exec(s, n) - s + 1;
+}
+#endif
+
+#if defined(CONFIG_BLOCK_CACHE) || defined(CONFIG_SIMPOINT_PROFILE)
+// instructions which may transfer control or stop the machine end a block
+bool isa_block_end(Decode *s) {
+  switch (BITS(s->isa.inst, 6, 0)) {
+    case 0x63: // branch
+    case 0x67: // jalr
+    case 0x6f: // jal
+    case 0x73: // system
+      return true;
+    default: return false;
+  }
+}
+#endif
+
+#if defined(CONFIG_PROFILER) || defined(CONFIG_FTRACE)
+int isa_jump_kind(Decode *s) {
+  uint32_t i = s->isa.inst;
+  int rd = BITS(i, 11, 7), rs1 = BITS(i, 19, 15);
+  bool rd_link = (rd == 1 || rd == 5), rs1_link = (rs1 == 1 || rs1 == 5);
+  switch (BITS(i, 6, 0)) {
+    case 0x6f: return (rd_link ? JUMP_CALL : JUMP_NONE); // jal
+    case 0x67: return (rd_link ? JUMP_CALL : (rd == 0 && rs1_link ? JUMP_RET : JUMP_NONE)); // jalr
+    default: return JUMP_NONE;
+  }
+}
+#endif
+
+#ifdef CONFIG_PERF_COUNTER
+bool isa_is_branch(Decode *s) {
+  return BITS(s->isa.inst, 6, 0) == 0x63;
+}
+#endif
+
+#ifdef CONFIG_BTRACE_REG
+int isa_inst_rd(Decode *s, word_t *val) {
+  uint32_t i = s->isa.inst;
+  int rd = BITS(i, 11, 7);
+  switch (BITS(i, 6, 0)) {
+    case 0x0f: case 0x23: case 0x63: return -1; // fence, store, branch
+    case 0x73: if (BITS(i, 14, 12) == 0) return -1; break; // ecall, ebreak, mret
+  }
+  if (rd == 0) return -1;
+  *val = gpr(rd);
+  return rd;
 }
+#endif
@@ -14,8 +14,11 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/perf.h>
 
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  // the highest bit of mcause is set for interrupts
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[(NO >> (sizeof(word_t) * 8 - 1)) ? PERF_INTR : PERF_EXCEPTION] ++);
   /* TODO: Trigger an interrupt/exception with ``NO''.
    * Then return the address of the interrupt/exception vector.
    */
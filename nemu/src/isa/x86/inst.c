@@ -17,6 +17,7 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/perf.h>
 
 typedef union {
   struct {
@@ -41,7 +42,7 @@ typedef union {
 } SIB;
 
 static word_t x86_inst_fetch(Decode *s, int len) {
-#if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE)
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE) || defined(CONFIG_IRINGBUF)
   uint8_t *p = &s->isa.inst[s->snpc - s->pc];
   word_t ret = inst_fetch(&s->snpc, len);
   word_t ret_save = ret;
@@ -119,8 +120,18 @@ static void decode_rm(Decode *s, int *rm_reg, word_t *rm_addr, int *reg, int wid
 
 #define Rr reg_read
 #define Rw reg_write
-#define Mr vaddr_read
-#define Mw vaddr_write
+
+// the accesses of the guest are counted here rather than in vaddr_*(),
+// which the monitor may call as well
+static inline word_t Mr(vaddr_t addr, int len) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_LOAD] ++);
+  return vaddr_read(addr, len);
+}
+
+static inline void Mw(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_PERF_COUNTER, g_perf[PERF_STORE] ++);
+  vaddr_write(addr, len, data);
+}
 #define RMr(reg, w)  (reg != -1 ? Rr(reg, w) : Mr(addr, w))
 #define RMw(data) do { if (rd != -1) Rw(rd, w, data); else Mw(addr, w, data); } while (0)
 
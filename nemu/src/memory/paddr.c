@@ -15,11 +15,17 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
+#include <cpu/decode.h>
+#include <cpu/block.h>
 #include <isa.h>
+#ifndef CONFIG_TARGET_AM
+#include <sys/mman.h>
+#endif
 
 #if   defined(CONFIG_PMEM_MALLOC)
-static uint8_t *pmem = NULL;
+static MACHINE_LOCAL uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
@@ -32,8 +38,62 @@ static word_t pmem_read(paddr_t addr, int len) {
   return ret;
 }
 
+#ifdef CONFIG_DECODE_CACHE
+static MACHINE_LOCAL uint8_t code_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+
+static inline uint8_t* code_page_of(paddr_t addr) {
+  return &code_page[(addr - CONFIG_MBASE) >> PAGE_SHIFT];
+}
+
+void pmem_mark_code(paddr_t addr) {
+  *code_page_of(addr) = 1;
+}
+
+static void code_page_check(paddr_t addr) {
+  uint8_t *p = code_page_of(addr);
+  if (unlikely(*p)) {
+    *p = 0;
+    decode_cache_flush_page(addr);
+    IFDEF(CONFIG_BLOCK_CACHE, block_flush_page(addr));
+  }
+}
+#endif
+
+static inline void pmem_written(paddr_t addr, int len) {
+#ifdef CONFIG_DECODE_CACHE
+  code_page_check(addr);
+  if (unlikely(((addr ^ (addr + len - 1)) & ~PAGE_MASK) != 0)) { code_page_check(addr + len - 1); }
+#endif
+}
+
 static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
+  pmem_written(addr, len);
+}
+
+// the other harts run in other host threads, so host atomics are used
+static bool pmem_cas(paddr_t addr, int len, word_t expect, word_t data) {
+  void *p = guest_to_host(addr);
+  bool ok;
+  switch (len) {
+    case 4: {
+      uint32_t e = expect;
+      ok = __atomic_compare_exchange_n((uint32_t *)p, &e, (uint32_t)data, false,
+          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      break;
+    }
+#ifdef CONFIG_ISA64
+    case 8: {
+      uint64_t e = expect;
+      ok = __atomic_compare_exchange_n((uint64_t *)p, &e, (uint64_t)data, false,
+          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      break;
+    }
+#endif
+    default: panic("bad length %d of an atomic access", len);
+  }
+  if (ok) pmem_written(addr, len);
+  return ok;
 }
 
 static void out_of_bound(paddr_t addr) {
@@ -42,7 +102,11 @@ static void out_of_bound(paddr_t addr) {
 }
 
 void init_mem() {
-#if   defined(CONFIG_PMEM_MALLOC)
+#if   defined(CONFIG_PMEM_MALLOC) && !defined(CONFIG_TARGET_AM)
+  // mapped, not allocated, so that pmem_map() can replace it
+  pmem = mmap(NULL, CONFIG_MSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(pmem != MAP_FAILED);
+#elif defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
 #endif
@@ -50,6 +114,35 @@ void init_mem() {
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
+void fini_mem() {
+#if defined(CONFIG_PMEM_MALLOC)
+  MUXDEF(CONFIG_TARGET_AM, free(pmem), munmap(pmem, CONFIG_MSIZE));
+  pmem = NULL;
+#endif
+}
+
+#ifndef CONFIG_TARGET_AM
+void pmem_map(paddr_t addr, size_t len, int fd, off_t offset) {
+  uint8_t *haddr = guest_to_host(addr);
+  int flags = MAP_PRIVATE | MAP_FIXED | (fd < 0 ? MAP_ANONYMOUS : 0);
+  void *p = mmap(haddr, len, PROT_READ | PROT_WRITE, flags, fd, (fd < 0 ? 0 : offset));
+  Assert(p == haddr, "Can not map [" FMT_PADDR ", " FMT_PADDR "] of pmem", addr, (paddr_t)(addr + len - 1));
+#ifdef CONFIG_DECODE_CACHE
+  // the code cached from the old content is stale
+  for (size_t off = 0; off < len; off += PAGE_SIZE) { code_page_check(addr + off); }
+#endif
+}
+
+void pmem_write_bytes(paddr_t addr, const void *buf, size_t len) {
+  memcpy(guest_to_host(addr), buf, len);
+#ifdef CONFIG_DECODE_CACHE
+  if (len == 0) return;
+  paddr_t last = (addr + len - 1) & ~PAGE_MASK;
+  for (paddr_t page = addr & ~PAGE_MASK; page <= last; page += PAGE_SIZE) { code_page_check(page); }
+#endif
+}
+#endif
+
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
@@ -57,8 +150,38 @@ word_t paddr_read(paddr_t addr, int len) {
   return 0;
 }
 
+#ifdef CONFIG_IDLE_FAST_FORWARD
+MACHINE_LOCAL uint64_t g_nr_paddr_write = 0;
+#endif
+
 void paddr_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_IDLE_FAST_FORWARD, g_nr_paddr_write ++);
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
+
+// accesses to devices are not atomic
+word_t paddr_amo(paddr_t addr, int len, word_t (*op)(word_t old, word_t src), word_t src) {
+  if (likely(in_pmem(addr))) {
+    IFDEF(CONFIG_IDLE_FAST_FORWARD, g_nr_paddr_write ++);
+    word_t old;
+    do {
+      old = pmem_read(addr, len);
+    } while (!pmem_cas(addr, len, old, op(old, src)));
+    return old;
+  }
+  word_t old = paddr_read(addr, len);
+  paddr_write(addr, len, op(old, src));
+  return old;
+}
+
+bool paddr_cas(paddr_t addr, int len, word_t expect, word_t data) {
+  if (likely(in_pmem(addr))) {
+    IFDEF(CONFIG_IDLE_FAST_FORWARD, g_nr_paddr_write ++);
+    return pmem_cas(addr, len, expect, data);
+  }
+  if (paddr_read(addr, len) != expect) return false;
+  paddr_write(addr, len, data);
+  return true;
+}
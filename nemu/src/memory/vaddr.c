@@ -16,14 +16,32 @@
 #include <isa.h>
 #include <memory/paddr.h>
 
+#ifdef CONFIG_BTRACE_MEM
+extern vaddr_t g_btrace_mem;
+extern bool g_btrace_mem_valid;
+#define btrace_mem(addr) (g_btrace_mem = (addr), g_btrace_mem_valid = true)
+#endif
+
 word_t vaddr_ifetch(vaddr_t addr, int len) {
   return paddr_read(addr, len);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
+  IFDEF(CONFIG_BTRACE_MEM, btrace_mem(addr));
   return paddr_read(addr, len);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_BTRACE_MEM, btrace_mem(addr));
   paddr_write(addr, len, data);
 }
+
+word_t vaddr_amo(vaddr_t addr, int len, word_t (*op)(word_t old, word_t src), word_t src) {
+  IFDEF(CONFIG_BTRACE_MEM, btrace_mem(addr));
+  return paddr_amo(addr, len, op, src);
+}
+
+bool vaddr_cas(vaddr_t addr, int len, word_t expect, word_t data) {
+  IFDEF(CONFIG_BTRACE_MEM, btrace_mem(addr));
+  return paddr_cas(addr, len, expect, data);
+}
@@ -0,0 +1,96 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Load an ELF image by its PT_LOAD segments. The whole pages of a segment
+ * are mapped from the file copy-on-write, and only the partial pages at
+ * both ends are copied. The whole pages of .bss are replaced by fresh zero
+ * pages, so the untouched ones never take host memory.
+ */
+
+#define Elf_Ehdr MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr)
+#define Elf_Phdr MUXDEF(CONFIG_ISA64, Elf64_Phdr, Elf32_Phdr)
+#define ELF_CLASS MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32)
+
+static void copy_from_file(int fd, paddr_t addr, paddr_t end, off_t offset) {
+  if (addr >= end) return;
+  ssize_t ret = pread(fd, guest_to_host(addr), end - addr, offset);
+  Assert(ret == end - addr, "Can not read the segment at " FMT_PADDR, addr);
+}
+
+static void load_segment(int fd, paddr_t addr, off_t offset, paddr_t filesz, paddr_t memsz) {
+  paddr_t file_end = addr + filesz, mem_end = addr + memsz;
+  paddr_t page_start = ROUNDUP(addr, PAGE_SIZE), page_end = file_end & ~PAGE_MASK;
+  if ((addr - offset) % PAGE_SIZE == 0 && page_start < page_end) {
+    copy_from_file(fd, addr, page_start, offset);
+    pmem_map(page_start, page_end - page_start, fd, offset + (page_start - addr));
+    copy_from_file(fd, page_end, file_end, offset + (page_end - addr));
+  } else {
+    copy_from_file(fd, addr, file_end, offset);
+  }
+
+  page_start = ROUNDUP(file_end, PAGE_SIZE);
+  page_end = mem_end & ~PAGE_MASK;
+  if (page_start < page_end) {
+    memset(guest_to_host(file_end), 0, page_start - file_end);
+    pmem_map(page_start, page_end - page_start, -1, 0);
+    memset(guest_to_host(page_end), 0, mem_end - page_end);
+  } else if (file_end < mem_end) {
+    memset(guest_to_host(file_end), 0, mem_end - file_end);
+  }
+}
+
+// Return the size of the image from RESET_VECTOR, or -1 if it is not ELF.
+long load_elf(const char *file) {
+  int fd = open(file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", file);
+  Elf_Ehdr eh;
+  if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0) {
+    close(fd);
+    return -1;
+  }
+  Assert(eh.e_ident[EI_CLASS] == ELF_CLASS, "'%s' is not a %d-bit ELF file", file, ISDEF(CONFIG_ISA64) ? 64 : 32);
+
+  Elf_Phdr *ph = malloc(sizeof(Elf_Phdr) * eh.e_phnum);
+  assert(ph);
+  ssize_t ret = pread(fd, ph, sizeof(Elf_Phdr) * eh.e_phnum, eh.e_phoff);
+  Assert(ret == sizeof(Elf_Phdr) * eh.e_phnum, "Can not read the program headers of '%s'", file);
+
+  paddr_t end = RESET_VECTOR;
+  int nr_seg = 0;
+  for (int i = 0; i < eh.e_phnum; i ++) {
+    Elf_Phdr *p = &ph[i];
+    if (p->p_type != PT_LOAD || p->p_memsz == 0) continue;
+    Assert(p->p_filesz <= p->p_memsz && in_pmem(p->p_paddr) && in_pmem(p->p_paddr + p->p_memsz - 1),
+        "Segment [" FMT_PADDR ", " FMT_PADDR "] is out of pmem",
+        (paddr_t)p->p_paddr, (paddr_t)(p->p_paddr + p->p_memsz - 1));
+    load_segment(fd, p->p_paddr, p->p_offset, p->p_filesz, p->p_memsz);
+    if (p->p_paddr + p->p_memsz > end) end = p->p_paddr + p->p_memsz;
+    nr_seg ++;
+  }
+  free(ph);
+  close(fd);
+
+  cpu.pc = eh.e_entry;
+  Log("The image is %s, an ELF with %d segments, entry = " FMT_WORD, file, nr_seg, cpu.pc);
+  return end - RESET_VECTOR;
+}
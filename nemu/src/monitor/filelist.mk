@@ -0,0 +1,24 @@
+#***************************************************************************************
+# Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/elf-loader.c
+
+ifndef CONFIG_TARGET_NATIVE_ELF
+SRCS-BLACKLIST-y += src/monitor/runner.c
+endif
+
+ifndef CONFIG_SNAPSHOT
+SRCS-BLACKLIST-y += src/monitor/snapshot.c
+endif
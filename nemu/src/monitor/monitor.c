@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/cpu.h>
 
 void init_rand();
 void init_log(const char *log_file);
@@ -41,10 +42,62 @@ static void welcome() {
 
 void sdb_set_batch_mode();
 
-static char *log_file = NULL;
-static char *diff_so_file = NULL;
-static char *img_file = NULL;
-static int difftest_port = 1234;
+static MACHINE_LOCAL char *log_file = NULL;
+static MACHINE_LOCAL char *diff_so_file = NULL;
+static MACHINE_LOCAL char *img_file = NULL;
+static MACHINE_LOCAL char *elf_file = NULL;
+static MACHINE_LOCAL int difftest_port = 1234;
+#ifdef CONFIG_TARGET_NATIVE_ELF
+static char *run_dir = NULL;
+static int run_jobs = 0;
+static uint64_t run_max_inst = -1;
+static int run_timeout = 0;
+static char *run_report = NULL;
+static char *fork_server = NULL;
+static char *fork_pc = NULL;
+void runner_main(char *dir, int jobs, uint64_t max_inst, int timeout, char *report);
+void fork_server_main(char *path, char *fork_pc, uint64_t max_inst, int timeout);
+#endif
+
+#ifdef CONFIG_TRACE
+#define NR_TRACE_WINDOW 16
+static MACHINE_LOCAL char *trace_window[NR_TRACE_WINDOW] = {};
+static MACHINE_LOCAL int nr_trace_window = 0;
+#endif
+
+#ifdef CONFIG_BTRACE
+static char *btrace_file = NULL;
+void init_btrace(const char *file);
+#endif
+
+#ifdef CONFIG_PERF_COUNTER
+#include <cpu/perf.h>
+static MACHINE_LOCAL char *stats_file = NULL;
+#endif
+
+#ifdef CONFIG_SNAPSHOT
+static MACHINE_LOCAL char *snapshot_load_file = NULL;
+static MACHINE_LOCAL char *snapshot_save_file = NULL;
+static MACHINE_LOCAL char *snapshot_save_pc = NULL;
+bool snapshot_save(const char *file);
+bool snapshot_load(const char *file);
+#endif
+
+#ifdef CONFIG_SIMPOINT_PROFILE
+static char *bbv_file = NULL;
+static char *simpoints_file = NULL;
+static char *checkpoint_prefix = NULL;
+void init_simpoint(const char *bbv_file, const char *simpoints_file, const char *prefix);
+#endif
+
+#ifdef CONFIG_TARGET_LIB
+#include <pthread.h>
+// getopt_long() keeps its state in globals, so machines parse their
+// arguments one at a time
+static pthread_mutex_t getopt_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+long load_elf(const char *file);
 
 static long load_img() {
   if (img_file == NULL) {
@@ -52,6 +105,13 @@ static long load_img() {
     return 4096; // built-in image size
   }
 
+  // an ELF image also brings its symbols
+  long elf_size = load_elf(img_file);
+  if (elf_size >= 0) {
+    if (elf_file == NULL) init_symbol(img_file);
+    return elf_size;
+  }
+
   FILE *fp = fopen(img_file, "rb");
   Assert(fp, "Can not open '%s'", img_file);
 
@@ -68,30 +128,131 @@ static long load_img() {
   return size;
 }
 
+long load_img_file(char *file) {
+  img_file = file;
+  return load_img();
+}
+
 static int parse_args(int argc, char *argv[]) {
   const struct option table[] = {
     {"batch"    , no_argument      , NULL, 'b'},
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"elf"      , required_argument, NULL, 'e'},
     {"help"     , no_argument      , NULL, 'h'},
+#ifdef CONFIG_TRACE
+    {"trace"    , required_argument, NULL, 'W'},
+#endif
+#ifdef CONFIG_BTRACE
+    {"btrace"   , required_argument, NULL, 'T'},
+#endif
+#ifdef CONFIG_PERF_COUNTER
+    {"stats"    , required_argument, NULL, 'X'},
+#endif
+#ifdef CONFIG_SNAPSHOT
+    {"load"     , required_argument, NULL, 'L'},
+    {"save"     , required_argument, NULL, 'S'},
+    {"save-at"  , required_argument, NULL, 's'},
+#endif
+#ifdef CONFIG_SIMPOINT_PROFILE
+    {"bbv"      , required_argument, NULL, 'B'},
+    {"simpoints", required_argument, NULL, 'P'},
+    {"checkpoint", required_argument, NULL, 'C'},
+#endif
+#ifdef CONFIG_TARGET_NATIVE_ELF
+    {"run-dir"  , required_argument, NULL, 'r'},
+    {"jobs"     , required_argument, NULL, 'j'},
+    {"max-inst" , required_argument, NULL, 'm'},
+    {"timeout"  , required_argument, NULL, 't'},
+    {"report"   , required_argument, NULL, 'R'},
+    {"fork-server", required_argument, NULL, 'F'},
+    {"fork-at"  , required_argument, NULL, 'a'},
+#endif
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:j:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'e': elf_file = optarg; break;
+#ifdef CONFIG_TRACE
+      case 'W':
+        // checked by init_monitor(), as getopt_lock is held here
+        if (nr_trace_window < NR_TRACE_WINDOW) trace_window[nr_trace_window] = optarg;
+        nr_trace_window ++;
+        break;
+#endif
+#ifdef CONFIG_BTRACE
+      case 'T': btrace_file = optarg; break;
+#endif
+#ifdef CONFIG_PERF_COUNTER
+      case 'X': stats_file = optarg; break;
+#endif
+#ifdef CONFIG_SNAPSHOT
+      case 'L': snapshot_load_file = optarg; break;
+      case 'S': snapshot_save_file = optarg; break;
+      case 's': snapshot_save_pc = optarg; break;
+#endif
+#ifdef CONFIG_SIMPOINT_PROFILE
+      case 'B': bbv_file = optarg; break;
+      case 'P': simpoints_file = optarg; break;
+      case 'C': checkpoint_prefix = optarg; break;
+#endif
+#ifdef CONFIG_TARGET_NATIVE_ELF
+      case 'r': run_dir = optarg; break;
+      case 'j': sscanf(optarg, "%d", &run_jobs); break;
+      case 'm': sscanf(optarg, "%" SCNu64, &run_max_inst); break;
+      case 't': sscanf(optarg, "%d", &run_timeout); break;
+      case 'R': run_report = optarg; break;
+      case 'F': fork_server = optarg; break;
+      case 'a': fork_pc = optarg; break;
+#endif
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
+        printf("IMAGE is either a raw binary loaded at the reset vector, or an ELF file.\n\n");
         printf("\t-b,--batch              run with batch mode\n");
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-e,--elf=FILE           read the symbols of the image from the ELF FILE\n");
+#ifdef CONFIG_TRACE
+        printf("\t--trace=KIND:ARG[:ARG]  limit the trace to range:LO:HI, func:NAME, after:PC|NAME\n");
+        printf("\t                        or inst:START:END, which may be given many times\n");
+        printf("\t                        (a cached block is traced whole if any of its pcs is in the window)\n");
+#endif
+#ifdef CONFIG_BTRACE
+        printf("\t--btrace=FILE           write the binary instruction trace to FILE\n");
+#endif
+#ifdef CONFIG_PERF_COUNTER
+        printf("\t--stats=FILE            save the event counters to FILE as JSON when NEMU exits\n");
+#endif
+#ifdef CONFIG_SNAPSHOT
+        printf("\t--load=FILE             restore the machine from the snapshot FILE\n");
+        printf("\t--save=FILE             save a snapshot to FILE when the image reaches --save-at\n");
+        printf("\t--save-at=PC            the pc where --save takes the snapshot\n");
+#endif
+#ifdef CONFIG_SIMPOINT_PROFILE
+        printf("\t--bbv=FILE              write basic block vectors for SimPoint to FILE\n");
+        printf("\t--simpoints=FILE        take checkpoints at the intervals listed in FILE\n");
+        printf("\t--checkpoint=PREFIX     save the checkpoints to PREFIX.<interval>\n");
+#endif
+#ifdef CONFIG_TARGET_NATIVE_ELF
+        printf("\t--run-dir=DIR           run every *.bin image in DIR and report the results\n");
+        printf("\t-j,--jobs=N             run N images in parallel with --run-dir\n");
+        printf("\t--max-inst=N            stop each run after N instructions\n");
+        printf("\t--timeout=SEC           stop each run after SEC seconds\n");
+        printf("\t--report=FILE           write the results to FILE (JUnit if it ends with .xml, JSON otherwise)\n");
+        printf("\t--fork-server=SOCKET    run the image once for every request on the unix socket SOCKET\n");
+        printf("\t--fork-at=PC            start serving requests when the image reaches PC\n");
+#endif
         printf("\n");
+        // a library must not end the process of its host
+        IFDEF(CONFIG_TARGET_LIB, return -1);
         exit(0);
     }
   }
@@ -100,9 +261,13 @@ static int parse_args(int argc, char *argv[]) {
 
 void init_monitor(int argc, char *argv[]) {
   /* Perform some global initialization. */
+  IFDEF(CONFIG_PERF_COUNTER, uint64_t init_start = get_time());
 
   /* Parse arguments. */
-  parse_args(argc, argv);
+  IFDEF(CONFIG_TARGET_LIB, pthread_mutex_lock(&getopt_lock); optind = 0);
+  int ret = parse_args(argc, argv);
+  IFDEF(CONFIG_TARGET_LIB, pthread_mutex_unlock(&getopt_lock));
+  Assert(ret == 0, "Bad arguments");
 
   /* Set random seed. */
   init_rand();
@@ -110,6 +275,12 @@ void init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log(log_file);
 
+  /* Open the binary trace. */
+  IFDEF(CONFIG_BTRACE, init_btrace(btrace_file));
+
+  /* Read the symbols of the image. */
+  if (elf_file != NULL) init_symbol(elf_file);
+
   /* Initialize memory. */
   init_mem();
 
@@ -122,17 +293,81 @@ void init_monitor(int argc, char *argv[]) {
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
+#ifdef CONFIG_TRACE
+  /* Set the trace window, which may refer to the symbols of the image. */
+  Assert(nr_trace_window <= NR_TRACE_WINDOW, "too many --trace");
+  for (int i = 0; i < nr_trace_window; i ++) {
+    Assert(trace_window_parse(trace_window[i]), "bad --trace=%s", trace_window[i]);
+  }
+#endif
+
+#ifdef CONFIG_SNAPSHOT
+  /* Restore the machine from a snapshot instead of starting from the image. */
+  if (snapshot_load_file != NULL) {
+    bool ok = snapshot_load(snapshot_load_file);
+    Assert(ok, "Can not load the snapshot");
+  }
+#endif
+
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
   /* Initialize the simple debugger. */
   init_sdb();
 
-  IFDEF(CONFIG_ITRACE, init_disasm());
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IRINGBUF)
+  init_disasm();
+#endif
+
+#ifdef CONFIG_PERF_COUNTER
+  /* Save the counters when NEMU exits. */
+  init_perf(stats_file);
+  g_perf_time[PERF_TIME_INIT] = get_time() - init_start;
+#endif
+
+#ifdef CONFIG_SNAPSHOT
+  /* Run to the given pc and take a snapshot there. */
+  if (snapshot_save_file != NULL) {
+    Assert(snapshot_save_pc != NULL, "--save needs --save-at");
+    vaddr_t pc = strtoull(snapshot_save_pc, NULL, 0);
+    cpu_exec_until(pc);
+    Assert(nemu_state.state == NEMU_STOP && cpu.pc == pc,
+        "The machine stops before reaching pc = " FMT_WORD, pc);
+    bool ok = snapshot_save(snapshot_save_file);
+    Assert(ok, "Can not save the snapshot");
+  }
+#endif
+
+  /* Start profiling for SimPoint. */
+  IFDEF(CONFIG_SIMPOINT_PROFILE, init_simpoint(bbv_file, simpoints_file, checkpoint_prefix));
+
+#ifdef CONFIG_TARGET_NATIVE_ELF
+  /* Run a directory of images instead of a single one. This does not return. */
+  if (run_dir != NULL) runner_main(run_dir, run_jobs, run_max_inst, run_timeout, run_report);
+  /* Fork a copy of the initialized machine for every request. This does not return. */
+  if (fork_server != NULL) fork_server_main(fork_server, fork_pc, run_max_inst, run_timeout);
+#endif
 
   /* Display welcome message. */
   welcome();
 }
+
+#ifdef CONFIG_TARGET_LIB
+void fini_mem();
+void fini_device();
+void fini_sdb();
+void fini_log();
+void fini_symbol();
+
+// Release what init_monitor() allocates.
+void fini_monitor() {
+  fini_sdb();
+  IFDEF(CONFIG_DEVICE, fini_device());
+  fini_mem();
+  fini_symbol();
+  fini_log();
+}
+#endif
 #else // CONFIG_TARGET_AM
 static long load_img() {
   extern char bin_start, bin_end;
@@ -0,0 +1,416 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* The runner executes every image in a directory, each in a worker forked
+ * from the initialized monitor, and reports the results of all of them.
+ * The fork server forks such a worker for every request from a client
+ * instead, so the same image is run again and again without initializing
+ * NEMU each time.
+ */
+
+#define OUTPUT_MAX 4096 // only the end of the output of a worker is reported
+
+enum { RUN_GOOD, RUN_BAD, RUN_ABORT, RUN_LIMIT, RUN_TIMEOUT, RUN_CRASH };
+static const char *verdict_name[] = {
+  [RUN_GOOD] = "good", [RUN_BAD] = "bad", [RUN_ABORT] = "abort",
+  [RUN_LIMIT] = "inst-limit", [RUN_TIMEOUT] = "timeout", [RUN_CRASH] = "crash",
+};
+
+typedef struct {
+  // filled by the worker in shared memory
+  int state;
+  bool timed_out;
+  vaddr_t halt_pc;
+  uint32_t halt_ret;
+  uint64_t nr_inst;
+  uint64_t time_us;
+  // filled by the runner
+  char *name;
+  int verdict;
+  int signal;
+  char *output;
+} RunResult;
+
+long load_img_file(char *file);
+extern uint64_t g_nr_guest_inst;
+int is_exit_status_bad();
+
+static volatile sig_atomic_t worker_timed_out = 0;
+
+static void worker_timeout(int sig) {
+  worker_timed_out = 1;
+  nemu_state.state = NEMU_QUIT;
+}
+
+// run the machine in a forked worker and record the result into `r`
+static void __attribute__((noreturn)) worker_run(RunResult *r, uint64_t max_inst, int timeout) {
+  void init_alarm();
+  // interval timers are not inherited by fork()
+  IFDEF(CONFIG_DEVICE, init_alarm());
+  if (timeout > 0) {
+    signal(SIGALRM, worker_timeout);
+    alarm(timeout);
+  }
+  uint64_t nr_inst = g_nr_guest_inst;
+  uint64_t start = get_time();
+  cpu_exec(max_inst);
+  r->time_us = get_time() - start;
+  r->nr_inst = g_nr_guest_inst - nr_inst;
+  r->timed_out = worker_timed_out;
+  r->state = nemu_state.state;
+  r->halt_pc = nemu_state.halt_pc;
+  r->halt_ret = nemu_state.halt_ret;
+  fflush(NULL);
+  _exit(is_exit_status_bad());
+}
+
+static void __attribute__((noreturn)) worker(RunResult *r, char *path, int out_fd,
+    uint64_t max_inst, int timeout) {
+  dup2(out_fd, STDOUT_FILENO);
+  dup2(out_fd, STDERR_FILENO);
+  close(out_fd);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  load_img_file(path);
+  worker_run(r, max_inst, timeout);
+}
+
+static int judge(RunResult *r, int status) {
+  if (WIFSIGNALED(status)) { r->signal = WTERMSIG(status); return RUN_CRASH; }
+  if (r->timed_out) return RUN_TIMEOUT;
+  switch (r->state) {
+    case NEMU_END: return (r->halt_ret == 0 ? RUN_GOOD : RUN_BAD);
+    case NEMU_QUIT: return RUN_GOOD;
+    case NEMU_ABORT: return RUN_ABORT;
+    case NEMU_STOP: return RUN_LIMIT;
+    default: return RUN_CRASH; // exited before cpu_exec() returns
+  }
+}
+
+static char* read_output(FILE *fp) {
+  long size = ftell(fp);
+  long start = (size > OUTPUT_MAX ? size - OUTPUT_MAX : 0);
+  char *buf = malloc(size - start + 1);
+  assert(buf);
+  fseek(fp, start, SEEK_SET);
+  size_t n = fread(buf, 1, size - start, fp);
+  buf[n] = '\0';
+  return buf;
+}
+
+static int cmp_name(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+// the regular files named *.bin, sorted by name
+static int scan_dir(const char *dir, char ***names) {
+  DIR *d = opendir(dir);
+  Assert(d, "Can not open directory '%s'", dir);
+  int n = 0, cap = 64;
+  char **list = malloc(sizeof(char *) * cap);
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    size_t len = strlen(e->d_name);
+    if (len < 4 || strcmp(e->d_name + len - 4, ".bin") != 0) continue;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+    if (n == cap) { cap *= 2; list = realloc(list, sizeof(char *) * cap); }
+    list[n ++] = strdup(e->d_name);
+  }
+  closedir(d);
+  qsort(list, n, sizeof(char *), cmp_name);
+  *names = list;
+  return n;
+}
+
+static void json_string(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; *s; s ++) {
+    unsigned char c = *s;
+    switch (c) {
+      case '"': fputs("\\\"", fp); break;
+      case '\\': fputs("\\\\", fp); break;
+      case '\n': fputs("\\n", fp); break;
+      case '\t': fputs("\\t", fp); break;
+      default:
+        if (c < 0x20) fprintf(fp, "\\u%04x", c);
+        else fputc(c, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+static void xml_string(FILE *fp, const char *s) {
+  for (; *s; s ++) {
+    unsigned char c = *s;
+    switch (c) {
+      case '&': fputs("&amp;", fp); break;
+      case '<': fputs("&lt;", fp); break;
+      case '>': fputs("&gt;", fp); break;
+      case '"': fputs("&quot;", fp); break;
+      default:
+        // control characters other than tab and newline are not allowed in XML
+        if (c < 0x20 && c != '\t' && c != '\n') fputc('?', fp);
+        else fputc(c, fp);
+    }
+  }
+}
+
+static uint64_t inst_per_sec(RunResult *r) {
+  return (r->time_us > 0 ? r->nr_inst * 1000000 / r->time_us : 0);
+}
+
+static void report_json(FILE *fp, const char *dir, RunResult *res, int n, int nr_fail, uint64_t time_us) {
+  fprintf(fp, "{\n  \"dir\": ");
+  json_string(fp, dir);
+  fprintf(fp, ",\n  \"total\": %d,\n  \"passed\": %d,\n  \"failed\": %d,\n"
+      "  \"time_us\": %" PRIu64 ",\n  \"results\": [\n", n, n - nr_fail, nr_fail, time_us);
+  for (int i = 0; i < n; i ++) {
+    RunResult *r = &res[i];
+    fprintf(fp, "    {\"name\": ");
+    json_string(fp, r->name);
+    fprintf(fp, ", \"verdict\": \"%s\", \"halt_pc\": \"" FMT_WORD "\", \"halt_ret\": %" PRIu32
+        ", \"signal\": %d, \"instructions\": %" PRIu64 ", \"time_us\": %" PRIu64
+        ", \"inst_per_sec\": %" PRIu64 ", \"output\": ",
+        verdict_name[r->verdict], r->halt_pc, r->halt_ret, r->signal,
+        r->nr_inst, r->time_us, inst_per_sec(r));
+    json_string(fp, r->output);
+    fprintf(fp, "}%s\n", (i == n - 1 ? "" : ","));
+  }
+  fprintf(fp, "  ]\n}\n");
+}
+
+static void report_junit(FILE *fp, const char *dir, RunResult *res, int n, int nr_fail, uint64_t time_us) {
+  int nr_error = 0;
+  for (int i = 0; i < n; i ++) {
+    if (res[i].verdict >= RUN_ABORT) nr_error ++;
+  }
+  fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuite name=\"");
+  xml_string(fp, dir);
+  fprintf(fp, "\" tests=\"%d\" failures=\"%d\" errors=\"%d\" time=\"%.6f\">\n",
+      n, nr_fail - nr_error, nr_error, time_us / 1e6);
+  for (int i = 0; i < n; i ++) {
+    RunResult *r = &res[i];
+    fprintf(fp, "  <testcase classname=\"nemu\" name=\"");
+    xml_string(fp, r->name);
+    fprintf(fp, "\" time=\"%.6f\">\n", r->time_us / 1e6);
+    fprintf(fp, "    <properties>\n"
+        "      <property name=\"instructions\" value=\"%" PRIu64 "\"/>\n"
+        "      <property name=\"inst_per_sec\" value=\"%" PRIu64 "\"/>\n"
+        "    </properties>\n", r->nr_inst, inst_per_sec(r));
+    if (r->verdict == RUN_BAD) {
+      fprintf(fp, "    <failure type=\"bad\" message=\"HIT BAD TRAP at pc = " FMT_WORD
+          ", code = %" PRIu32 "\"/>\n", r->halt_pc, r->halt_ret);
+    } else if (r->verdict != RUN_GOOD) {
+      fprintf(fp, "    <error type=\"%s\" message=\"%s", verdict_name[r->verdict], verdict_name[r->verdict]);
+      if (r->verdict == RUN_CRASH) fprintf(fp, ", signal %d", r->signal);
+      fprintf(fp, "\"/>\n");
+    }
+    fprintf(fp, "    <system-out>");
+    xml_string(fp, r->output);
+    fprintf(fp, "</system-out>\n  </testcase>\n");
+  }
+  fprintf(fp, "</testsuite>\n");
+}
+
+void runner_main(char *dir, int jobs, uint64_t max_inst, int timeout, char *report) {
+  char **names = NULL;
+  int n = scan_dir(dir, &names);
+  if (jobs <= 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  Log("Run %d images in %s with %d workers", n, dir, jobs);
+
+  RunResult *res = mmap(NULL, sizeof(RunResult) * (n > 0 ? n : 1), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(res != MAP_FAILED);
+  pid_t *pid = calloc(n + 1, sizeof(pid_t));
+  FILE **out = calloc(n + 1, sizeof(FILE *));
+
+  uint64_t start = get_time();
+  int next = 0, nr_running = 0, nr_done = 0, nr_fail = 0;
+  while (nr_done < n) {
+    while (nr_running < jobs && next < n) {
+      RunResult *r = &res[next];
+      r->state = -1;
+      out[next] = tmpfile();
+      assert(out[next]);
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "%s/%s", dir, names[next]);
+      fflush(NULL);
+      pid[next] = fork();
+      assert(pid[next] >= 0);
+      if (pid[next] == 0) worker(r, path, fileno(out[next]), max_inst, timeout);
+      nr_running ++;
+      next ++;
+    }
+
+    int status;
+    pid_t p = wait(&status);
+    assert(p > 0);
+    int i;
+    for (i = 0; i < next && pid[i] != p; i ++) ;
+    assert(i < next);
+    RunResult *r = &res[i];
+    r->name = names[i];
+    r->verdict = judge(r, status);
+    fseek(out[i], 0, SEEK_END);
+    r->output = read_output(out[i]);
+    fclose(out[i]);
+    nr_running --;
+    nr_done ++;
+    if (r->verdict != RUN_GOOD) nr_fail ++;
+    printf("[%d/%d] %-10s %s (%" PRIu64 " inst, %" PRIu64 " us)\n", nr_done, n,
+        verdict_name[r->verdict], r->name, r->nr_inst, r->time_us);
+  }
+  uint64_t time_us = get_time() - start;
+
+  Log("%d/%d images passed in %" PRIu64 " us", n - nr_fail, n, time_us);
+  if (report != NULL) {
+    FILE *fp = fopen(report, "w");
+    Assert(fp, "Can not open '%s'", report);
+    size_t len = strlen(report);
+    bool junit = (len >= 4 && strcmp(report + len - 4, ".xml") == 0);
+    (junit ? report_junit : report_json)(fp, dir, res, n, nr_fail, time_us);
+    fclose(fp);
+    Log("Report is written to %s", report);
+  }
+  exit(nr_fail != 0);
+}
+
+static bool read_full(int fd, void *buf, size_t len) {
+  for (size_t n = 0; n < len; ) {
+    ssize_t ret = read(fd, (uint8_t *)buf + n, len - n);
+    if (ret <= 0) return false;
+    n += ret;
+  }
+  return true;
+}
+
+static char* read_line(int fd, char *buf, size_t len) {
+  size_t n = 0;
+  while (n < len - 1) {
+    if (read(fd, &buf[n], 1) != 1) return NULL;
+    if (buf[n] == '\n') break;
+    n ++;
+  }
+  buf[n] = '\0';
+  return buf;
+}
+
+/* Serve the requests of a client, one line each:
+ *   run [MAX_INST [ADDR LEN]]  followed by LEN bytes which are copied to
+ *                              guest memory at ADDR before running
+ *   quit                       stop the fork server
+ * A line of results is replied for every run.
+ */
+static bool serve(int fd, RunResult *r, uint64_t max_inst, int timeout) {
+  char line[256];
+  while (read_line(fd, line, sizeof(line)) != NULL) {
+    char cmd[16] = "";
+    uint64_t n = max_inst;
+    paddr_t addr = 0;
+    uint32_t len = 0;
+    int nr_arg = sscanf(line, "%15s %" SCNu64 " %" SCNx32 " %" SCNu32, cmd, &n, &addr, &len);
+    if (strcmp(cmd, "quit") == 0) return false;
+    if (strcmp(cmd, "run") != 0 || nr_arg == 3 ||
+        (len > 0 && !(in_pmem(addr) && len <= PMEM_RIGHT - addr + 1))) {
+      dprintf(fd, "error bad request\n");
+      continue;
+    }
+
+    uint8_t *input = NULL;
+    if (len > 0) {
+      input = malloc(len);
+      assert(input);
+      if (!read_full(fd, input, len)) { free(input); break; }
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->state = -1;
+    uint64_t start = get_time();
+    fflush(NULL);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      close(fd);
+      if (len > 0) pmem_write_bytes(addr, input, len);
+      worker_run(r, n, timeout);
+    }
+    free(input);
+
+    int status;
+    waitpid(pid, &status, 0);
+    uint64_t total_us = get_time() - start;
+    r->verdict = judge(r, status);
+    dprintf(fd, "%s status=%d signal=%d halt_pc=" FMT_WORD " halt_ret=%" PRIu32
+        " instructions=%" PRIu64 " time_us=%" PRIu64 " total_us=%" PRIu64 "\n",
+        verdict_name[r->verdict], WIFEXITED(status) ? WEXITSTATUS(status) : -1, r->signal,
+        r->halt_pc, r->halt_ret, r->nr_inst, r->time_us, total_us);
+  }
+  return true;
+}
+
+void fork_server_main(char *path, char *fork_pc, uint64_t max_inst, int timeout) {
+  if (fork_pc != NULL) {
+    vaddr_t pc = strtoull(fork_pc, NULL, 0);
+    cpu_exec_until(pc);
+    Assert(nemu_state.state == NEMU_STOP && cpu.pc == pc,
+        "The machine stops before reaching pc = " FMT_WORD, pc);
+    Log("Fork server takes over at pc = " FMT_WORD " after %" PRIu64 " instructions", pc, g_nr_guest_inst);
+  }
+
+  RunResult *r = mmap(NULL, sizeof(RunResult), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(r != MAP_FAILED);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(sock >= 0);
+  struct sockaddr_un sa = { .sun_family = AF_UNIX };
+  Assert(strlen(path) < sizeof(sa.sun_path), "Socket path '%s' is too long", path);
+  strcpy(sa.sun_path, path);
+  unlink(path);
+  int ret = bind(sock, (struct sockaddr *)&sa, sizeof(sa));
+  Assert(ret == 0, "Can not bind to '%s'", path);
+  ret = listen(sock, 1);
+  assert(ret == 0);
+  signal(SIGPIPE, SIG_IGN);
+  Log("Fork server is listening on %s", path);
+
+  bool running = true;
+  while (running) {
+    int fd = accept(sock, NULL, NULL);
+    if (fd < 0) continue;
+    running = serve(fd, r, max_inst, timeout);
+    close(fd);
+  }
+
+  close(sock);
+  unlink(path);
+  Log("Fork server stops");
+  exit(0);
+}
@@ -82,8 +82,8 @@ static struct rule
 
 #define NR_REGEX ARRLEN(rules)
 
-static regex_t re[NR_REGEX] = {};
-bool division_zero = 0;
+static MACHINE_LOCAL regex_t re[NR_REGEX] = {};
+MACHINE_LOCAL bool division_zero = 0;
 /* Rules are used for many times.
  * Therefore we compile them only once before any usage.
  */
@@ -104,14 +104,22 @@ void init_regex()
 	}
 }
 
+void fini_regex()
+{
+	for (int i = 0; i < NR_REGEX; i++)
+	{
+		regfree(&re[i]);
+	}
+}
+
 typedef struct token
 {
 	int type;
 	char str[32];
 } Token;
 
-static Token tokens[1000] __attribute__((used)) = {};
-static int nr_token __attribute__((used)) = 0;
+static MACHINE_LOCAL Token tokens[1000] __attribute__((used)) = {};
+static MACHINE_LOCAL int nr_token __attribute__((used)) = 0;
 
 static bool make_token(char *e)
 {
@@ -24,9 +24,10 @@
 #include "/home/zs/ysyx-workbench/nemu/src/monitor/sdb/watchpoint.h"
 #include "/home/zs/ysyx-workbench/nemu/src/monitor/sdb/expr.h"
 
-static int is_batch_mode = false;
+static MACHINE_LOCAL int is_batch_mode = false;
 
 void init_regex();
+void fini_regex();
 void init_wp_pool();
 void watchpoint_create();
 void sdb_watchpoint_display();
@@ -37,7 +38,7 @@ void watchpoint_delete();
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 static char *rl_gets()
 {
-  static char *line_read = NULL;
+  static MACHINE_LOCAL char *line_read = NULL;
 
   if (line_read) {
     free(line_read);
@@ -134,6 +135,57 @@ static int cmd_q(char *args) {
   return -1;
 }
 
+#ifdef CONFIG_SNAPSHOT
+bool snapshot_save(const char *file);
+bool snapshot_load(const char *file);
+
+static int cmd_save(char *args) {
+  char *file = strtok(args, " ");
+  if (file == NULL) { printf("Usage: save FILE\n"); return 0; }
+  snapshot_save(file);
+  return 0;
+}
+
+static int cmd_load(char *args) {
+  char *file = strtok(args, " ");
+  if (file == NULL) { printf("Usage: load FILE\n"); return 0; }
+  snapshot_load(file);
+  return 0;
+}
+#endif
+
+#ifdef CONFIG_FTRACE
+void ftrace_dump(FILE *fp);
+
+static int cmd_ftrace(char *args) {
+  ftrace_dump(stdout);
+  return 0;
+}
+#endif
+
+#ifdef CONFIG_PERF_COUNTER
+#include <cpu/perf.h>
+
+static int cmd_stats(char *args) {
+  char *file = strtok(args, " ");
+  if (file == NULL) perf_dump(stdout);
+  else if (perf_save(file)) printf("Statistics are saved to %s\n", file);
+  return 0;
+}
+#endif
+
+#ifdef CONFIG_TRACE
+static int cmd_trace(char *args) {
+  char *kind = strtok(args, " ");
+  if (kind == NULL) { trace_window_show(); return 0; }
+  if (strcmp(kind, "clear") == 0) { trace_window_clear(); return 0; }
+  char *arg1 = strtok(NULL, " ");
+  char *arg2 = strtok(NULL, " ");
+  trace_window_add(kind, arg1, arg2);
+  return 0;
+}
+#endif
+
 static int cmd_help(char *args);
 
 static struct {
@@ -149,7 +201,20 @@ static struct {
   {"x","scan memory",cmd_x},
   {"p","Expression evaluation",cmd_p},
   {"w","create watchpoint",cmd_w},
-  {"d","delete watchpoint",cmd_d}
+  {"d","delete watchpoint",cmd_d},
+#ifdef CONFIG_TRACE
+  {"trace", "Show the trace window, clear it, or add range LO HI, func NAME, after PC or inst START END, checked once per cached block", cmd_trace},
+#endif
+#ifdef CONFIG_FTRACE
+  {"ftrace", "Print the recent calls and returns", cmd_ftrace},
+#endif
+#ifdef CONFIG_PERF_COUNTER
+  {"stats", "Print the event counters as JSON, or save them to FILE", cmd_stats},
+#endif
+#ifdef CONFIG_SNAPSHOT
+  {"save", "Save a snapshot of the machine to FILE", cmd_save},
+  {"load", "Restore the machine from the snapshot FILE", cmd_load},
+#endif
   /* TODO: Add more commands */
 
 };
@@ -228,3 +293,7 @@ void init_sdb() {
   /* Initialize the watchpoint pool. */
   init_wp_pool();
 }
+
+void fini_sdb() {
+  fini_regex();
+}
@@ -18,8 +18,8 @@
 
 //uint32_t expr(char *e, bool *flag);
 
-WP wp_pool[NR_WP];
-static WP *head = NULL,
+MACHINE_LOCAL WP wp_pool[NR_WP];
+static MACHINE_LOCAL WP *head = NULL,
           *free_ = NULL;
 
 void init_wp_pool() {
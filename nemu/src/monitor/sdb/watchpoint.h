@@ -19,9 +19,9 @@ typedef struct watchpoint
 
 } WP;
 
-extern WP wp_pool[NR_WP];
-static WP *head __attribute__((unused));
-static WP *free_ __attribute__((unused));
+extern MACHINE_LOCAL WP wp_pool[NR_WP];
+static MACHINE_LOCAL WP *head __attribute__((unused));
+static MACHINE_LOCAL WP *free_ __attribute__((unused));
 
 void init_wp_pool();
 WP *new_wp();
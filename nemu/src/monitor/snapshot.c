@@ -0,0 +1,182 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/map.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A snapshot file holds a header, the state of the CPU and NEMU, the
+ * device registers in all spaces, and then pmem from a page aligned
+ * offset. Pages of pmem which are all zero are not written, so they are
+ * holes of a sparse file. Restoring maps pmem from the file copy-on-write,
+ * so only the pages touched later are read. A snapshot is written to a
+ * temporary file which then replaces `file`, since truncating the file
+ * pmem is mapped from would make the unread pages of pmem fault.
+ */
+
+#define SNAPSHOT_MAGIC "NEMUSNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t cpu_size;
+  uint64_t mbase, msize;
+  uint64_t space_size;
+  uint64_t pmem_offset;
+} SnapshotHeader;
+
+typedef struct {
+  CPU_state cpu;
+  NEMUState nemu_state;
+  uint64_t nr_guest_inst;
+  uint64_t icount_skipped;
+} SnapshotState;
+
+extern MACHINE_LOCAL uint64_t g_nr_guest_inst;
+void device_sync();
+
+static uint8_t *get_space(size_t *size) {
+#ifdef CONFIG_DEVICE
+  return map_space(size);
+#else
+  *size = 0;
+  return NULL;
+#endif
+}
+
+static bool write_at(int fd, const void *buf, size_t len, off_t offset) {
+  for (size_t n = 0; n < len; ) {
+    ssize_t ret = pwrite(fd, (const uint8_t *)buf + n, len - n, offset + n);
+    if (ret <= 0) return false;
+    n += ret;
+  }
+  return true;
+}
+
+static bool read_at(int fd, void *buf, size_t len, off_t offset) {
+  for (size_t n = 0; n < len; ) {
+    ssize_t ret = pread(fd, (uint8_t *)buf + n, len - n, offset + n);
+    if (ret <= 0) return false;
+    n += ret;
+  }
+  return true;
+}
+
+bool snapshot_save(const char *file) {
+  char *tmp_file = malloc(strlen(file) + 8);
+  assert(tmp_file);
+  sprintf(tmp_file, "%s.XXXXXX", file);
+  int fd = mkstemp(tmp_file);
+  if (fd < 0 || fchmod(fd, 0644) != 0) {
+    printf("Can not create '%s'\n", tmp_file);
+    if (fd >= 0) { close(fd); unlink(tmp_file); }
+    free(tmp_file);
+    return false;
+  }
+
+  size_t space_size;
+  uint8_t *space = get_space(&space_size);
+  SnapshotHeader h = {
+    .magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION, .cpu_size = sizeof(CPU_state),
+    .mbase = CONFIG_MBASE, .msize = CONFIG_MSIZE, .space_size = space_size,
+  };
+  h.pmem_offset = ROUNDUP(sizeof(h) + sizeof(SnapshotState) + space_size, PAGE_SIZE);
+  SnapshotState st = {
+    .cpu = cpu, .nemu_state = nemu_state, .nr_guest_inst = g_nr_guest_inst,
+    .icount_skipped = MUXDEF(CONFIG_TIME_ICOUNT, get_icount_skipped(), 0),
+  };
+
+  bool ok = write_at(fd, &h, sizeof(h), 0) &&
+    write_at(fd, &st, sizeof(st), sizeof(h)) &&
+    write_at(fd, space, space_size, sizeof(h) + sizeof(st));
+
+  static const uint8_t zero_page[PAGE_SIZE] = {};
+  uint8_t *mem = guest_to_host(PMEM_LEFT);
+  size_t nr_page = 0;
+  for (size_t off = 0; ok && off < CONFIG_MSIZE; off += PAGE_SIZE) {
+    if (memcmp(mem + off, zero_page, PAGE_SIZE) == 0) continue;
+    ok = write_at(fd, mem + off, PAGE_SIZE, h.pmem_offset + off);
+    nr_page ++;
+  }
+  ok = ok && ftruncate(fd, h.pmem_offset + CONFIG_MSIZE) == 0;
+  close(fd);
+  ok = ok && rename(tmp_file, file) == 0;
+  if (!ok) unlink(tmp_file);
+  free(tmp_file);
+
+  if (!ok) {
+    printf("Can not write the snapshot to '%s'\n", file);
+    return false;
+  }
+  Log("Snapshot is saved to %s at pc = " FMT_WORD ", %zu pages of pmem are written",
+      file, cpu.pc, nr_page);
+  return true;
+}
+
+bool snapshot_load(const char *file) {
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+
+  // check everything before the machine is changed
+  size_t space_size;
+  uint8_t *space = get_space(&space_size);
+  SnapshotHeader h;
+  SnapshotState st;
+  const char *err = NULL;
+  if (!read_at(fd, &h, sizeof(h), 0) || memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0) {
+    err = "not a snapshot";
+  } else if (h.version != SNAPSHOT_VERSION || h.cpu_size != sizeof(CPU_state)) {
+    err = "saved by another version of NEMU";
+  } else if (h.mbase != CONFIG_MBASE || h.msize != CONFIG_MSIZE) {
+    err = "pmem is configured differently";
+  } else if (h.space_size != space_size) {
+    err = "devices are configured differently";
+  } else if (!read_at(fd, &st, sizeof(st), sizeof(h))) {
+    err = "truncated";
+  } else if (lseek(fd, 0, SEEK_END) < (off_t)(h.pmem_offset + CONFIG_MSIZE)) {
+    err = "truncated";
+  }
+  if (err != NULL) {
+    printf("Can not load '%s': %s\n", file, err);
+    close(fd);
+    return false;
+  }
+
+  bool ok = read_at(fd, space, space_size, sizeof(h) + sizeof(st));
+  Assert(ok, "Can not read the device registers from '%s'", file);
+  pmem_map(PMEM_LEFT, CONFIG_MSIZE, fd, h.pmem_offset);
+  close(fd);
+
+  cpu = st.cpu;
+  nemu_state = st.nemu_state;
+  if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+  g_nr_guest_inst = st.nr_guest_inst;
+  // unsigned arithmetic sets the counter to the saved value
+  IFDEF(CONFIG_TIME_ICOUNT, icount_skip(st.icount_skipped - get_icount_skipped()));
+  IFDEF(CONFIG_DEVICE, device_sync());
+
+  Log("Snapshot is loaded from %s at pc = " FMT_WORD " after %" PRIu64 " instructions",
+      file, cpu.pc, g_nr_guest_inst);
+  return true;
+}
@@ -20,6 +20,155 @@ void am_init_monitor();
 void engine_start();
 int is_exit_status_bad();
 
+#ifdef CONFIG_TARGET_LIB
+#include <pthread.h>
+#include <difftest-def.h>
+
+void fini_monitor();
+void cpu_exec(uint64_t n);
+
+enum { REQ_NONE, REQ_RUN, REQ_STEP, REQ_FINI };
+
+/* A machine is served by a thread of its own, whose thread-local storage
+ * holds the whole state of the machine. The host drives it by requests,
+ * so any host thread may step any machine.
+ */
+typedef struct NEMUMachine {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int argc;
+  char **argv;
+  int req;     // the request being served, or REQ_NONE
+  uint64_t n;  // instructions to execute for REQ_STEP
+  int state;   // nemu_state.state after the last request
+  bool dead;   // the machine failed and its thread has exited
+  int ret;
+} NEMUMachine;
+
+static MACHINE_LOCAL NEMUMachine *this_machine = NULL;
+
+static void machine_done(NEMUMachine *m) {
+  pthread_mutex_lock(&m->lock);
+  m->state = nemu_state.state;
+  m->req = REQ_NONE;
+  pthread_cond_broadcast(&m->cond);
+  pthread_mutex_unlock(&m->lock);
+}
+
+// run on the thread of a machine when Assert() ends it
+static void machine_cleanup(void *arg) {
+  NEMUMachine *m = arg;
+  fini_monitor();
+  pthread_mutex_lock(&m->lock);
+  m->ret = 1;
+  m->dead = true;
+  pthread_cond_broadcast(&m->cond);
+  pthread_mutex_unlock(&m->lock);
+}
+
+// End the machine of the current thread, or the process outside machines.
+void machine_abort() {
+  if (this_machine != NULL) pthread_exit(NULL);
+  abort();
+}
+
+static void* machine_main(void *arg) {
+  NEMUMachine *m = arg;
+  this_machine = m;
+  pthread_cleanup_push(machine_cleanup, m);
+  init_monitor(m->argc, m->argv);
+  machine_done(m);
+  while (true) {
+    pthread_mutex_lock(&m->lock);
+    while (m->req == REQ_NONE) pthread_cond_wait(&m->cond, &m->lock);
+    int req = m->req;
+    pthread_mutex_unlock(&m->lock);
+    if (req == REQ_FINI) break;
+    if (req == REQ_RUN) engine_start();
+    else cpu_exec(m->n);
+    machine_done(m);
+  }
+  m->ret = is_exit_status_bad();
+  fini_monitor();
+  pthread_cleanup_pop(0);
+  return NULL;
+}
+
+// Wait until the machine finishes its request or fails.
+static void machine_wait(NEMUMachine *m) {
+  while (m->req != REQ_NONE && !m->dead) pthread_cond_wait(&m->cond, &m->lock);
+}
+
+static void machine_request(NEMUMachine *m, int req, uint64_t n) {
+  pthread_mutex_lock(&m->lock);
+  if (!m->dead) {
+    m->req = req;
+    m->n = n;
+    pthread_cond_broadcast(&m->cond);
+    machine_wait(m);
+  }
+  pthread_mutex_unlock(&m->lock);
+}
+
+/* Destroy the machine, and return its exit status as main() does. */
+__EXPORT int nemu_fini(NEMUMachine *m) {
+  pthread_mutex_lock(&m->lock);
+  m->req = REQ_FINI; // served by exiting, so not waited for
+  pthread_cond_broadcast(&m->cond);
+  pthread_mutex_unlock(&m->lock);
+  pthread_join(m->thread, NULL);
+  int ret = m->ret;
+  pthread_cond_destroy(&m->cond);
+  pthread_mutex_destroy(&m->lock);
+  free(m);
+  return ret;
+}
+
+/* Create a machine with the command line `argv` as main() does, and
+ * return NULL if it fails. `argv` should be kept until nemu_fini().
+ */
+__EXPORT NEMUMachine* nemu_init(int argc, char *argv[]) {
+  NEMUMachine *m = malloc(sizeof(*m));
+  assert(m);
+  *m = (NEMUMachine) { .argc = argc, .argv = argv, .req = REQ_RUN, .ret = 1 };
+  pthread_mutex_init(&m->lock, NULL);
+  pthread_cond_init(&m->cond, NULL);
+  int ret = pthread_create(&m->thread, NULL, machine_main, m);
+  Assert(ret == 0, "cannot create the thread of a machine");
+  pthread_mutex_lock(&m->lock);
+  machine_wait(m); // for init_monitor()
+  bool dead = m->dead;
+  pthread_mutex_unlock(&m->lock);
+  if (dead) {
+    nemu_fini(m);
+    return NULL;
+  }
+  return m;
+}
+
+/* Execute at most `n` instructions of the machine. Return 0 if it may go
+ * on, or 1 if it has stopped for good: the guest ended or NEMU failed.
+ */
+__EXPORT int nemu_step(NEMUMachine *m, uint64_t n) {
+  machine_request(m, REQ_STEP, n);
+  pthread_mutex_lock(&m->lock);
+  int ret = m->dead || (m->state != NEMU_RUNNING && m->state != NEMU_STOP);
+  pthread_mutex_unlock(&m->lock);
+  return ret;
+}
+
+/* Run a machine to its end as main() does, and return its exit status.
+ * Many machines may run at the same time, e.g. one for each thread of a
+ * thread pool. A failure of NEMU, such as a panic, ends only its machine.
+ */
+__EXPORT int nemu_main(int argc, char *argv[]) {
+  NEMUMachine *m = nemu_init(argc, argv);
+  if (m == NULL) return 1;
+  machine_request(m, REQ_RUN, 0);
+  return nemu_fini(m);
+}
+#else
 int main(int argc, char *argv[]) {
   /* Initialize the monitor. */
 #ifdef CONFIG_TARGET_AM
@@ -33,3 +182,4 @@ int main(int argc, char *argv[]) {
 
   return is_exit_status_bad();
 }
+#endif
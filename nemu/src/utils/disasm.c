@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <dlfcn.h>
+#include <ctype.h>
 #include <capstone/capstone.h>
 #include <common.h>
 
@@ -59,13 +60,94 @@ void init_disasm() {
 #endif
 }
 
-void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+static bool cs_disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
 	cs_insn *insn;
 	size_t count = cs_disasm_dl(handle, code, nbyte, pc, 0, &insn);
-  assert(count == 1);
+  if (count != 1) {
+    // e.g. the invalid instruction which aborts the machine
+    snprintf(str, size, "(bad)");
+    return false;
+  }
   int ret = snprintf(str, size, "%s", insn->mnemonic);
   if (insn->op_str[0] != '\0') {
     snprintf(str + ret, size - ret, "\t%s", insn->op_str);
   }
   cs_free_dl(insn, count);
+  return true;
+}
+
+/* The text of an instruction is cached by its bytes. Whether the text
+ * depends on the pc is found by disassembling it at another pc as well.
+ * If only one hex number differs, e.g. the target of a jump, the entry
+ * keeps its distance to the pc, and the number is filled in on a hit.
+ */
+
+#define NR_DISASM_CACHE 4096
+#define DISASM_MAX 96
+
+typedef struct {
+  uint8_t code[16];
+  int nbyte;   // 0 if the entry is invalid
+  int split;   // where the pc-relative number goes in `str`, or -1
+  int64_t delta;
+  char str[DISASM_MAX];
+} DisasmEntry;
+
+static DisasmEntry cache[NR_DISASM_CACHE];
+static uint64_t nr_hit = 0, nr_miss = 0;
+
+static DisasmEntry* cache_entry(uint8_t *code, int nbyte) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < nbyte; i ++) h = (h ^ code[i]) * 16777619u;
+  return &cache[(h ^ (h >> 16)) % NR_DISASM_CACHE];
+}
+
+// find the hex number which contains `s[i]`, and return where it starts
+static int hex_start(const char *s, int i) {
+  while (i > 0 && isxdigit((unsigned char)s[i - 1])) i --;
+  return (i >= 2 && s[i - 2] == '0' && s[i - 1] == 'x') ? i - 2 : -1;
+}
+
+static void cache_fill(DisasmEntry *e, uint64_t pc, uint8_t *code, int nbyte, const char *s1) {
+  e->nbyte = 0;
+  if (nbyte > sizeof(e->code) || strlen(s1) >= DISASM_MAX) return;
+  char s2[DISASM_MAX];
+  uint64_t pc2 = (word_t)(pc + 0x1000);
+  if (!cs_disassemble(s2, sizeof(s2), pc2, code, nbyte)) return;
+  int i = 0;
+  while (s1[i] != '\0' && s1[i] == s2[i]) i ++;
+  if (s1[i] == '\0' && s2[i] == '\0') {
+    e->split = -1;
+    strcpy(e->str, s1);
+  } else {
+    int start = hex_start(s1, i);
+    if (start < 0 || start != hex_start(s2, i)) return;
+    char *end1, *end2;
+    uint64_t v1 = strtoull(s1 + start, &end1, 16);
+    uint64_t v2 = strtoull(s2 + start, &end2, 16);
+    if (strcmp(end1, end2) != 0 || v1 - pc != v2 - pc2) return;
+    e->split = start;
+    e->delta = v1 - pc;
+    snprintf(e->str, sizeof(e->str), "%.*s%s", start, s1, end1);
+  }
+  memcpy(e->code, code, nbyte);
+  e->nbyte = nbyte;
+}
+
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+  DisasmEntry *e = cache_entry(code, nbyte);
+  if (e->nbyte == nbyte && memcmp(e->code, code, nbyte) == 0) {
+    nr_hit ++;
+    if (e->split < 0) snprintf(str, size, "%s", e->str);
+    else snprintf(str, size, "%.*s0x%" PRIx64 "%s", e->split, e->str,
+        (uint64_t)(word_t)(pc + e->delta), e->str + e->split);
+    return;
+  }
+  nr_miss ++;
+  if (cs_disassemble(str, size, pc, code, nbyte)) cache_fill(e, pc, code, nbyte, str);
+}
+
+void disasm_statistic() {
+  if (nr_hit + nr_miss == 0) return;
+  Log("disassembly cache: hits = %" PRIu64 ", misses = %" PRIu64, nr_hit, nr_miss);
 }
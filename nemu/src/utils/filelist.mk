@@ -13,7 +13,14 @@
 # See the Mulan PSL v2 for more details.
 #**************************************************************************************/
 
-ifeq ($(CONFIG_ITRACE)$(CONFIG_IQUEUE),)
+SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/utils/symbol.c
+
+ifneq ($(CONFIG_TRACE),y)
+SRCS-BLACKLIST-y += src/utils/trace.c
+endif
+SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/utils/trace.c
+
+ifeq ($(CONFIG_ITRACE)$(CONFIG_IQUEUE)$(CONFIG_IRINGBUF),)
 SRCS-BLACKLIST-y += src/utils/disasm.c
 else
 LIBCAPSTONE = tools/capstone/repo/libcapstone.so.5
@@ -22,3 +29,7 @@ src/utils/disasm.c: $(LIBCAPSTONE)
 $(LIBCAPSTONE):
 	$(MAKE) -C tools/capstone
 endif
+
+ifdef CONFIG_LOG_ASYNC
+LIBS += -lpthread
+endif
@@ -15,10 +15,143 @@
 
 #include <common.h>
 
-extern uint64_t g_nr_guest_inst;
-
 #ifndef CONFIG_TARGET_AM
-FILE *log_fp = NULL;
+MACHINE_LOCAL FILE *log_fp = NULL;
+
+#ifdef CONFIG_LOG_ASYNC
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* The log file is written by a writer thread. The emulation thread only
+ * formats a record and copies it into a ring buffer, and the writer
+ * drains the ring with large write() calls. There is only one producer,
+ * so the ring needs no lock: `head` is only moved by the producer and
+ * `tail` only by the writer. The writer sleeps on a futex while the ring
+ * is empty, and the producer wakes it after a push.
+ */
+
+#define RING_SIZE CONFIG_LOG_ASYNC_SIZE
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "size of the log buffer should be a power of 2");
+
+static char ring[RING_SIZE];
+static uint64_t head = 0, tail = 0;
+static int log_fd = -1; // -1 if the log is written synchronously
+static uint32_t writer_idle = 0; // the writer waits on it for an empty ring
+
+static void sleep_us(long us) {
+  struct timespec t = { .tv_sec = 0, .tv_nsec = us * 1000 };
+  nanosleep(&t, NULL);
+}
+
+static void futex(uint32_t *addr, int op, uint32_t val) {
+  syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static void* log_writer(void *arg) {
+  while (true) {
+    uint64_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (h == tail) {
+      // announce before checking again, so that a push in between wakes us
+      __atomic_store_n(&writer_idle, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&head, __ATOMIC_SEQ_CST) == tail) futex(&writer_idle, FUTEX_WAIT_PRIVATE, 1);
+      __atomic_store_n(&writer_idle, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+    size_t off = tail & (RING_SIZE - 1);
+    size_t len = MIN(h - tail, RING_SIZE - off);
+    ssize_t n = write(log_fd, ring + off, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) n = len; // drop what can not be written
+    __atomic_store_n(&tail, tail + n, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void ring_push(const char *s, size_t len) {
+  while (len > 0) {
+    size_t space = RING_SIZE - (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+    if (space == 0) { sleep_us(10); continue; }
+    size_t off = head & (RING_SIZE - 1);
+    size_t n = MIN(MIN(len, space), RING_SIZE - off);
+    memcpy(ring + off, s, n);
+    __atomic_store_n(&head, head + n, __ATOMIC_SEQ_CST);
+    s += n;
+    len -= n;
+    if (__atomic_load_n(&writer_idle, __ATOMIC_SEQ_CST)) {
+      __atomic_store_n(&writer_idle, 0, __ATOMIC_RELAXED);
+      futex(&writer_idle, FUTEX_WAKE_PRIVATE, 1);
+    }
+  }
+}
+
+// wait until the writer drains the ring, which is safe in a signal handler
+void log_flush() {
+  if (log_fd < 0) return;
+  while (__atomic_load_n(&tail, __ATOMIC_ACQUIRE) != head) sleep_us(100);
+}
+
+void log_async(const char *fmt, ...) {
+  char buf[1024], *p = buf;
+  va_list ap;
+  va_start(ap, fmt);
+  if (log_fd < 0) {
+    if (log_fp != NULL) {
+      vfprintf(log_fp, fmt, ap);
+      fflush(log_fp);
+    }
+    va_end(ap);
+    return;
+  }
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len >= sizeof(buf)) {
+    p = malloc(len + 1);
+    va_start(ap, fmt);
+    vsnprintf(p, len + 1, fmt, ap);
+    va_end(ap);
+  }
+  if (len > 0) ring_push(p, len);
+  if (p != buf) free(p);
+}
+
+static void log_signal(int sig) {
+  log_flush();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+// the writer thread is not inherited, so a child writes synchronously,
+// and what is left in the ring is written by the parent
+static void log_atfork_child() {
+  log_fd = -1;
+  tail = head;
+}
+
+static void init_log_writer(FILE *fp) {
+  log_fd = fileno(fp);
+  // the signals are handled by the other threads
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, log_writer, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  Assert(ret == 0, "cannot create the thread to write the log");
+  pthread_detach(t);
+
+  pthread_atfork(NULL, NULL, log_atfork_child);
+  atexit(log_flush);
+  int sigs[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGINT, SIGTERM };
+  for (int i = 0; i < ARRLEN(sigs); i ++) signal(sigs[i], log_signal);
+}
+#endif
 
 void init_log(const char *log_file) {
   log_fp = stdout;
@@ -26,12 +159,21 @@ void init_log(const char *log_file) {
     FILE *fp = fopen(log_file, "w");
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
+    IFDEF(CONFIG_LOG_ASYNC, init_log_writer(fp));
   }
   Log("Log is written to %s", log_file ? log_file : "stdout");
 }
 
+void fini_log() {
+  IFDEF(CONFIG_LOG_ASYNC, log_flush());
+  if (log_fp != NULL && log_fp != stdout) fclose(log_fp);
+  log_fp = NULL;
+}
+
+#ifndef CONFIG_TRACE
+// see trace.c otherwise
 bool log_enable() {
-  return MUXDEF(CONFIG_TRACE, (g_nr_guest_inst >= CONFIG_TRACE_START) &&
-         (g_nr_guest_inst <= CONFIG_TRACE_END), false);
+  return false;
 }
 #endif
+#endif
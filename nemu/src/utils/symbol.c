@@ -0,0 +1,127 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <common.h>
+#include <elf.h>
+
+// the functions in the symbol table of the guest ELF, sorted by address
+typedef struct {
+  vaddr_t addr;
+  word_t size;
+  char *name;
+} Symbol;
+
+static MACHINE_LOCAL Symbol *sym = NULL;
+static MACHINE_LOCAL int nr_sym = 0;
+static MACHINE_LOCAL char *strtab = NULL;
+
+static int cmp_addr(const void *a, const void *b) {
+  vaddr_t x = ((Symbol *)a)->addr, y = ((Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+// one more byte is allocated and zeroed, so a string table read is terminated
+static void* read_at(FILE *fp, long offset, size_t size) {
+  char *buf = malloc(size + 1);
+  assert(buf);
+  if (fseek(fp, offset, SEEK_SET) != 0 || (size > 0 && fread(buf, size, 1, fp) != 1)) {
+    free(buf);
+    return NULL;
+  }
+  buf[size] = '\0';
+  return buf;
+}
+
+// ELF32 and ELF64 only differ in the widths of the fields used here
+#define LOAD_SYMBOLS(Ehdr, Shdr, Sym, ST_TYPE) do { \
+  Ehdr eh; \
+  if (fseek(fp, 0, SEEK_SET) != 0 || fread(&eh, sizeof(eh), 1, fp) != 1) return false; \
+  Shdr *sh = read_at(fp, eh.e_shoff, sizeof(Shdr) * eh.e_shnum); \
+  if (sh == NULL) return false; \
+  for (int i = 0; i < eh.e_shnum; i ++) { \
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh.e_shnum) continue; \
+    Shdr *str = &sh[sh[i].sh_link]; \
+    Sym *st = read_at(fp, sh[i].sh_offset, sh[i].sh_size); \
+    strtab = read_at(fp, str->sh_offset, str->sh_size); \
+    if (st == NULL || strtab == NULL) { free(st); free(sh); return false; } \
+    int n = sh[i].sh_size / sizeof(Sym); \
+    sym = malloc(sizeof(Symbol) * n); \
+    assert(sym); \
+    for (int j = 0; j < n; j ++) { \
+      if (ST_TYPE(st[j].st_info) != STT_FUNC || st[j].st_value == 0 || st[j].st_name >= str->sh_size) continue; \
+      sym[nr_sym ++] = (Symbol) { .addr = st[j].st_value, .size = st[j].st_size, .name = strtab + st[j].st_name }; \
+    } \
+    free(st); \
+    break; \
+  } \
+  free(sh); \
+} while (0)
+
+static bool load_symbols(FILE *fp) {
+  unsigned char ident[EI_NIDENT];
+  if (fread(ident, sizeof(ident), 1, fp) != 1 || memcmp(ident, ELFMAG, SELFMAG) != 0) return false;
+  if (ident[EI_CLASS] == ELFCLASS32) LOAD_SYMBOLS(Elf32_Ehdr, Elf32_Shdr, Elf32_Sym, ELF32_ST_TYPE);
+  else if (ident[EI_CLASS] == ELFCLASS64) LOAD_SYMBOLS(Elf64_Ehdr, Elf64_Shdr, Elf64_Sym, ELF64_ST_TYPE);
+  else return false;
+  return true;
+}
+
+void fini_symbol() {
+  free(sym);
+  free(strtab);
+  sym = NULL;
+  strtab = NULL;
+  nr_sym = 0;
+}
+
+void init_symbol(const char *elf_file) {
+  fini_symbol(); // the symbols of an image loaded before
+  FILE *fp = fopen(elf_file, "rb");
+  Assert(fp, "Can not open '%s'", elf_file);
+  bool ok = load_symbols(fp);
+  fclose(fp);
+  Assert(ok, "'%s' is not a valid ELF file", elf_file);
+  qsort(sym, nr_sym, sizeof(Symbol), cmp_addr);
+  Log("%d function symbols are read from %s", nr_sym, elf_file);
+}
+
+// The function containing `addr`, or NULL if there is none. A function
+// with no size is taken to extend to the next one.
+const char* symbol_find(vaddr_t addr, vaddr_t *start) {
+  int l = 0, r = nr_sym;
+  while (l < r) { // the first symbol above `addr`
+    int m = (l + r) / 2;
+    if (sym[m].addr <= addr) l = m + 1;
+    else r = m;
+  }
+  if (l == 0) return NULL;
+  Symbol *s = &sym[l - 1];
+  if (s->size != 0 && addr - s->addr >= s->size) return NULL;
+  if (start != NULL) *start = s->addr;
+  return s->name;
+}
+
+// The range [start, end) of the function `name`.
+bool symbol_lookup(const char *name, vaddr_t *start, vaddr_t *end) {
+  for (int i = 0; i < nr_sym; i ++) {
+    if (strcmp(sym[i].name, name) != 0) continue;
+    *start = sym[i].addr;
+    if (sym[i].size != 0) *end = sym[i].addr + sym[i].size;
+    else *end = (i + 1 < nr_sym ? sym[i + 1].addr : sym[i].addr + 1);
+    return true;
+  }
+  return false;
+}
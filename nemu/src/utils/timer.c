@@ -44,6 +44,35 @@ uint64_t get_time() {
   return now - boot_time;
 }
 
+#ifdef CONFIG_TIME_ICOUNT
+extern MACHINE_LOCAL uint64_t g_nr_guest_inst;
+
+// instructions which are counted by the guest clock but never executed
+static MACHINE_LOCAL uint64_t icount_skipped = 0;
+
+uint64_t get_icount() {
+  return g_nr_guest_inst + icount_skipped;
+}
+
+void icount_skip(uint64_t n) {
+  icount_skipped += n;
+}
+
+uint64_t get_icount_skipped() {
+  return icount_skipped;
+}
+#endif
+
+// The time seen by the guest. In icount mode, it only depends on the
+// number of instructions executed, so runs are reproducible.
+uint64_t get_guest_time() {
+#ifdef CONFIG_TIME_ICOUNT
+  return get_icount() * CONFIG_ICOUNT_NS_PER_INST / 1000;
+#else
+  return get_time();
+#endif
+}
+
 void init_rand() {
   srand(get_time_internal());
 }
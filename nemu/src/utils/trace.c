@@ -0,0 +1,159 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <ctype.h>
+
+/* The trace window decides which instructions are traced. Besides the
+ * range of instruction counts, tracing can be limited to some ranges of
+ * pc, e.g. the functions in the ELF, or only start when a pc is reached.
+ * The window is checked once when a cached block is entered, against all
+ * the pcs of the block: the block is traced as a whole if any of them is
+ * in the window, and a trigger inside it starts tracing from its start.
+ * Interpreted code has no block with a known end, so its instructions
+ * are checked one by one. Nothing is paid when there are no such limits.
+ */
+
+#define NR_RANGE 16
+
+typedef struct {
+  vaddr_t lo, hi; // [lo, hi)
+} Range;
+
+extern MACHINE_LOCAL uint64_t g_nr_guest_inst;
+
+MACHINE_LOCAL bool g_trace_filter = false; // whether trace_block() should be called
+static MACHINE_LOCAL bool pc_on = true;   // whether the current block is traced
+static MACHINE_LOCAL Range range[NR_RANGE];
+static MACHINE_LOCAL int nr_range = 0;
+static MACHINE_LOCAL bool has_trigger = false;
+static MACHINE_LOCAL vaddr_t trigger_pc = 0;
+static MACHINE_LOCAL uint64_t inst_start = CONFIG_TRACE_START;
+static MACHINE_LOCAL uint64_t inst_end = CONFIG_TRACE_END;
+
+bool log_enable() {
+  return pc_on && (g_nr_guest_inst >= inst_start) && (g_nr_guest_inst <= inst_end);
+}
+
+// the block holds the instructions from `pc` to `last`
+void trace_block(vaddr_t pc, vaddr_t last) {
+  if (has_trigger) {
+    if (trigger_pc < pc || trigger_pc > last) { pc_on = false; return; }
+    has_trigger = false;
+    g_trace_filter = (nr_range > 0);
+  }
+  bool on = (nr_range == 0);
+  for (int i = 0; i < nr_range && !on; i ++) on = (range[i].lo <= last && pc < range[i].hi);
+  pc_on = on;
+}
+
+// a number or the name of a function
+static bool parse_addr(const char *s, vaddr_t *addr, vaddr_t *end) {
+  if (s == NULL) return false;
+  if (isdigit((unsigned char)s[0])) {
+    char *p;
+    *addr = strtoull(s, &p, 0);
+    return *p == '\0';
+  }
+  vaddr_t e;
+  return symbol_lookup(s, addr, (end != NULL ? end : &e));
+}
+
+static bool add_range(vaddr_t lo, vaddr_t hi) {
+  if (nr_range == NR_RANGE) { printf("At most %d ranges can be traced\n", NR_RANGE); return false; }
+  range[nr_range ++] = (Range) { .lo = lo, .hi = hi };
+  g_trace_filter = true;
+  pc_on = false; // decided when the next block starts
+  return true;
+}
+
+/* Add a limit to the trace window:
+ *   range LO HI    trace the pc in [LO, HI)
+ *   func NAME      trace the pc in the function NAME
+ *   after PC       start tracing when PC, or a function, is reached
+ *   inst START END trace the instructions from START to END
+ */
+bool trace_window_add(const char *kind, const char *arg1, const char *arg2) {
+  vaddr_t lo, hi;
+  if (kind == NULL) kind = "";
+  if (strcmp(kind, "range") == 0) {
+    if (!parse_addr(arg1, &lo, NULL) || !parse_addr(arg2, &hi, NULL) || lo >= hi) {
+      printf("Usage: range LO HI\n");
+      return false;
+    }
+    return add_range(lo, hi);
+  }
+  if (strcmp(kind, "func") == 0) {
+    if (arg1 == NULL || !symbol_lookup(arg1, &lo, &hi)) {
+      printf("Can not find the function '%s'\n", arg1 ? arg1 : "");
+      return false;
+    }
+    return add_range(lo, hi);
+  }
+  if (strcmp(kind, "after") == 0) {
+    if (!parse_addr(arg1, &lo, NULL)) { printf("Usage: after PC|FUNC\n"); return false; }
+    trigger_pc = lo;
+    has_trigger = true;
+    g_trace_filter = true;
+    pc_on = false;
+    return true;
+  }
+  if (strcmp(kind, "inst") == 0) {
+    char *p1 = NULL, *p2 = NULL;
+    uint64_t start = 0, end = 0;
+    if (arg1 != NULL) start = strtoull(arg1, &p1, 0);
+    if (arg2 != NULL) end = strtoull(arg2, &p2, 0);
+    if (p1 == NULL || *p1 != '\0' || p2 == NULL || *p2 != '\0') {
+      printf("Usage: inst START END\n");
+      return false;
+    }
+    inst_start = start;
+    inst_end = end;
+    return true;
+  }
+  printf("Unknown trace window '%s', which should be range, func, after or inst\n", kind);
+  return false;
+}
+
+// parse "KIND:ARG1[:ARG2]" from the command line
+bool trace_window_parse(char *spec) {
+  char *save;
+  char *kind = strtok_r(spec, ":", &save);
+  char *arg1 = strtok_r(NULL, ":", &save);
+  char *arg2 = strtok_r(NULL, ":", &save);
+  return trace_window_add(kind, arg1, arg2);
+}
+
+void trace_window_clear() {
+  nr_range = 0;
+  has_trigger = false;
+  g_trace_filter = false;
+  pc_on = true;
+  inst_start = CONFIG_TRACE_START;
+  inst_end = CONFIG_TRACE_END;
+}
+
+void trace_window_show() {
+  printf("instructions: %" PRIu64 " - %" PRIu64 "\n", inst_start, inst_end);
+  for (int i = 0; i < nr_range; i ++) {
+    vaddr_t start;
+    const char *name = symbol_find(range[i].lo, &start);
+    printf("pc: [" FMT_WORD ", " FMT_WORD ")", range[i].lo, range[i].hi);
+    if (name != NULL && start == range[i].lo) printf(" %s", name);
+    printf("\n");
+  }
+  if (has_trigger) printf("after: " FMT_WORD " is reached\n", trigger_pc);
+  printf("the current block is %straced\n", (pc_on ? "" : "not "));
+}
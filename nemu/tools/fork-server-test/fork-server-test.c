@@ -0,0 +1,100 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Check the fork server of a riscv32 NEMU: the input of a request which
+ * overwrites code already executed before the fork should be executed.
+ *
+ *   fork-server-test NEMU
+ *
+ * The image uses addi, bne and ebreak, so they should be implemented.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// the body at 0x80000004 runs once before the fork at 0x80000008, and
+// once more in the child
+static const uint32_t img[] = {
+  0x00200293, // 0x80000000: addi t0, zero, 2
+  0x00000513, // 0x80000004: addi a0, zero, 0
+  0xfff28293, // 0x80000008: addi t0, t0, -1
+  0xfe029ce3, // 0x8000000c: bne  t0, zero, 0x80000004
+  0x00100073, // 0x80000010: ebreak
+};
+#define PATCH 0x00100513 // addi a0, zero, 1
+
+static int nr_fail = 0;
+
+static void request(int fd, const char *line, const void *input, size_t len, const char *expect) {
+  char reply[512];
+  size_t n = 0;
+  dprintf(fd, "%s\n", line);
+  if (len > 0 && write(fd, input, len) != len) { perror("write"); exit(1); }
+  while (n < sizeof(reply) - 1 && read(fd, &reply[n], 1) == 1 && reply[n] != '\n') n ++;
+  reply[n] = '\0';
+  bool ok = (strstr(reply, expect) != NULL);
+  printf("%s  %s -> %s\n", (ok ? "PASS" : "FAIL"), line, reply);
+  if (!ok) nr_fail ++;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) { fprintf(stderr, "usage: %s NEMU\n", argv[0]); return 1; }
+  char img_file[] = "/tmp/fork-server-test-XXXXXX";
+  int img_fd = mkstemp(img_file);
+  if (img_fd < 0 || write(img_fd, img, sizeof(img)) != sizeof(img)) { perror("image"); return 1; }
+  close(img_fd);
+  char sock_file[64], sock_arg[80];
+  snprintf(sock_file, sizeof(sock_file), "%s.sock", img_file);
+  snprintf(sock_arg, sizeof(sock_arg), "--fork-server=%s", sock_file);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    execl(argv[1], argv[1], sock_arg, "--fork-at=0x80000008", img_file, (char *)NULL);
+    perror("exec");
+    _exit(1);
+  }
+
+  struct sockaddr_un sa = { .sun_family = AF_UNIX };
+  strncpy(sa.sun_path, sock_file, sizeof(sa.sun_path) - 1);
+  int fd = -1;
+  for (int i = 0; i < 100 && fd < 0; i ++) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) { close(fd); fd = -1; usleep(50000); }
+  }
+  if (fd < 0) { fprintf(stderr, "can not connect to the fork server\n"); kill(pid, SIGKILL); return 1; }
+
+  uint32_t patch = PATCH;
+  request(fd, "run 100", NULL, 0, "halt_ret=0");
+  request(fd, "run 100 80000004 4", &patch, sizeof(patch), "halt_ret=1");
+  request(fd, "run 100", NULL, 0, "halt_ret=0"); // the patch is not kept
+  request(fd, "run 100 87fffffd 4", NULL, 0, "error bad request");
+  request(fd, "run 100 80000010 4294967290", NULL, 0, "error bad request");
+  dprintf(fd, "quit\n");
+  close(fd);
+  waitpid(pid, NULL, 0);
+  unlink(img_file);
+  unlink(sock_file);
+  printf("%s\n", (nr_fail == 0 ? "all passed" : "FAILED"));
+  return nr_fail != 0;
+}
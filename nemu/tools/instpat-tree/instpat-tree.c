@@ -0,0 +1,404 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Generate a decision tree for each INSTPAT_START()/INSTPAT_END() block
+ * of an ISA source file. The tree switches on fields which are fixed by
+ * the patterns, and jumps to the label of the first matching INSTPAT(),
+ * which is named by its line. When the tree finds no pattern, the code
+ * falls through to the sequential matching in INSTPAT().
+ *
+ * Patterns between #if and #endif may be compiled out, so the tree does
+ * not jump to them. A leaf which reaches such a pattern leaves the rest
+ * of its patterns to the sequential matching.
+ *
+ * With a profile dumped by NEMU built with CONFIG_INSTPAT_PROFILE, the
+ * source file is printed with the INSTPAT() lines of each block sorted
+ * by their counts instead. A pattern only moves ahead of the patterns
+ * which can not match the same instruction, so the first match of any
+ * instruction is kept, and the catch-all pattern stays last. Patterns
+ * never move across a conditional directive.
+ *
+ * Usage: instpat-tree inst.c > instpat-tree.h
+ *        instpat-tree -p profile inst.c > inst-sorted.c
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#define MAX_PAT 1024
+#define MAX_FIELD_WIDTH 8
+#define MAX_LEAF 2 // patterns checked one by one at a leaf
+
+typedef struct {
+  uint64_t mask, key; // (inst & mask) == key
+  int line;
+  int region; // patterns are separated by conditional directives
+  bool cond;  // between #if and #endif
+  char str[80];
+} Pattern;
+
+static const char *file;
+static Pattern pat[MAX_PAT];
+static int nr_pat = 0;
+
+static char **src = NULL; // lines of the source file, from index 1
+static int nr_line = 0;
+
+static void die(int line, const char *msg) {
+  fprintf(stderr, "%s:%d: %s\n", file, line, msg);
+  exit(1);
+}
+
+static int cond_depth, cond_region;
+
+static void parse_pattern(const char *p, int line) {
+  uint64_t mask = 0, key = 0;
+  int width = 0;
+  const char *end = strchr(p, '"');
+  if (end == NULL || end - p >= sizeof(pat[0].str)) die(line, "invalid pattern string");
+  if (nr_pat == MAX_PAT) die(line, "too many patterns");
+  memcpy(pat[nr_pat].str, p, end - p);
+  pat[nr_pat].str[end - p] = '\0';
+  for (; p != end; p ++) {
+    if (*p == ' ') continue;
+    if (*p != '0' && *p != '1' && *p != '?') die(line, "invalid character in pattern string");
+    mask = (mask << 1) | (*p != '?');
+    key  = (key  << 1) | (*p == '1');
+    width ++;
+  }
+  if (width > 64) die(line, "pattern too long");
+  pat[nr_pat].mask = mask;
+  pat[nr_pat].key = key;
+  pat[nr_pat].line = line;
+  pat[nr_pat].region = cond_region;
+  pat[nr_pat].cond = (cond_depth > 0);
+  nr_pat ++;
+}
+
+// --- tree generation ---
+
+static int indent = 1;
+
+static void emit(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void emit(const char *fmt, ...) {
+  va_list ap;
+  printf("%*s", indent * 2, "");
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf(" \\\n");
+}
+
+// Keep the patterns which may still match the instructions whose bits
+// in `kmask` are `kval`, and drop those after one which always matches.
+static int filter(const int *in, int n, uint64_t kmask, uint64_t kval, int *out) {
+  int i, m = 0;
+  for (i = 0; i < n; i ++) {
+    Pattern *p = &pat[in[i]];
+    uint64_t both = p->mask & kmask;
+    if ((p->key & both) != (kval & both)) continue;
+    out[m ++] = in[i];
+    if ((p->mask & ~kmask) == 0) break;
+  }
+  return m;
+}
+
+static bool same_list(const int *a, int na, const int *b, int nb) {
+  return na == nb && memcmp(a, b, na * sizeof(*a)) == 0;
+}
+
+static void gen(const int *list, int n, uint64_t kmask, uint64_t kval);
+
+static void gen_leaf(const int *list, int n, uint64_t kmask) {
+  int i;
+  for (i = 0; i < n; i ++) {
+    Pattern *p = &pat[list[i]];
+    if (p->cond) break;
+    uint64_t mask = p->mask & ~kmask;
+    if (mask == 0) emit("INSTPAT_TREE_GOTO(concat(__instpat_, %d));", p->line);
+    else emit("if ((__inst & 0x%llxull) == 0x%llxull) INSTPAT_TREE_GOTO(concat(__instpat_, %d));",
+        (unsigned long long)mask, (unsigned long long)(p->key & mask), p->line);
+  }
+}
+
+// Find the field [lo, lo + w) to switch on. Prefer the longest run of
+// bits fixed by all patterns, e.g. the opcode. Otherwise choose the field
+// with the shortest longest case, then with the fewest patterns in total.
+static bool choose_field(const int *list, int n, uint64_t kmask, uint64_t kval, int *plo, int *pw) {
+  static int tmp[MAX_PAT];
+  uint64_t common = ~kmask;
+  int i, lo, w;
+  for (i = 0; i < n; i ++) {
+    Pattern *p = &pat[list[i]];
+    if (i == n - 1 && (p->mask & ~kmask) == 0) break; // the catch-all
+    common &= p->mask;
+  }
+  int best_w = 0;
+  for (lo = 0; lo < 64; lo ++) {
+    for (w = 0; lo + w < 64 && w < MAX_FIELD_WIDTH && (common >> (lo + w) & 1); w ++) ;
+    if (w > best_w) { best_w = w; *plo = lo; *pw = w; }
+  }
+  if (best_w > 0) return true;
+
+  int best_max = n, best_total = 0;
+  bool found = false;
+  for (lo = 0; lo < 64; lo ++) {
+    for (w = 1; w <= MAX_FIELD_WIDTH && lo + w <= 64; w ++) {
+      uint64_t fmask = ((1ull << w) - 1) << lo;
+      if (kmask & fmask) break;
+      int v, max = 0, total = 0;
+      for (v = 0; v < (1 << w); v ++) {
+        int m = filter(list, n, kmask | fmask, kval | ((uint64_t)v << lo), tmp);
+        if (m > max) max = m;
+        total += m;
+      }
+      if (max < best_max || (found && max == best_max && total < best_total)) {
+        best_max = max; best_total = total;
+        *plo = lo; *pw = w;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+static void gen(const int *list, int n, uint64_t kmask, uint64_t kval) {
+  int lo = 0, w = 0;
+  if (n <= MAX_LEAF || !choose_field(list, n, kmask, kval, &lo, &w)) {
+    gen_leaf(list, n, kmask);
+    return;
+  }
+
+  uint64_t fmask = ((1ull << w) - 1) << lo;
+  int nr_val = 1 << w;
+  int (*sub)[MAX_PAT] = malloc(sizeof(*sub) * nr_val);
+  int *nr_sub = malloc(sizeof(int) * nr_val);
+  bool *done = calloc(nr_val, sizeof(bool));
+  int v, u;
+  for (v = 0; v < nr_val; v ++) {
+    nr_sub[v] = filter(list, n, kmask | fmask, kval | ((uint64_t)v << lo), sub[v]);
+  }
+  // the most common list goes to `default`
+  int dft = 0, dft_count = 0;
+  for (v = 0; v < nr_val; v ++) {
+    int count = 0;
+    for (u = 0; u < nr_val; u ++) count += same_list(sub[v], nr_sub[v], sub[u], nr_sub[u]);
+    if (count > dft_count) { dft = v; dft_count = count; }
+  }
+
+  emit("switch ((__inst >> %d) & 0x%llx) {", lo, (unsigned long long)(fmask >> lo));
+  for (v = 0; v < nr_val; v ++) {
+    if (done[v] || same_list(sub[v], nr_sub[v], sub[dft], nr_sub[dft])) continue;
+    // values with the same list share the code
+    uint64_t vmask = fmask;
+    for (u = v; u < nr_val; u ++) {
+      if (!done[u] && same_list(sub[v], nr_sub[v], sub[u], nr_sub[u])) {
+        indent ++;
+        emit("case 0x%x:", u);
+        indent --;
+        vmask &= ~((uint64_t)(u ^ v) << lo);
+        done[u] = true;
+      }
+    }
+    indent += 2;
+    gen(sub[v], nr_sub[v], kmask | vmask, kval | (((uint64_t)v << lo) & vmask));
+    emit("break;");
+    indent -= 2;
+  }
+  indent ++;
+  emit("default:");
+  indent ++;
+  gen(sub[dft], nr_sub[dft], kmask, kval);
+  indent -= 2;
+  emit("}");
+  free(sub); free(nr_sub); free(done);
+}
+
+static void gen_block(int line) {
+  static int list[MAX_PAT];
+  int i;
+  for (i = 0; i < nr_pat; i ++) list[i] = i;
+  printf("#define __instpat_tree_%d(inst) do { \\\n", line);
+  printf("  __attribute__((unused)) uint64_t __inst = (inst); \\\n");
+  indent = 1;
+  gen(list, filter(list, nr_pat, 0, 0, list), 0, 0);
+  printf("} while (0)\n\n");
+}
+
+// --- reordering by profile ---
+
+static uint64_t *prof_count = NULL; // indexed by line
+
+static void load_profile(const char *name) {
+  FILE *fp = fopen(name, "r");
+  if (fp == NULL) { perror(name); exit(1); }
+  prof_count = calloc(nr_line + 1, sizeof(uint64_t));
+  char buf[256], str[80];
+  int line;
+  unsigned long long count;
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    if (sscanf(buf, "%d %llu %*s \"%79[^\"]\"", &line, &count, str) != 3) continue;
+    const char *p = (line > 0 && line <= nr_line ? strchr(src[line], '"') : NULL);
+    if (p == NULL || strncmp(p + 1, str, strlen(str)) != 0 || p[1 + strlen(str)] != '"') {
+      fprintf(stderr, "%s: pattern \"%s\" is not at line %d of %s, the profile is stale\n",
+          name, str, line, file);
+      exit(1);
+    }
+    prof_count[line] = count;
+  }
+  fclose(fp);
+}
+
+static bool overlap(Pattern *a, Pattern *b) {
+  return ((a->key ^ b->key) & a->mask & b->mask) == 0;
+}
+
+static void reorder_block() {
+  static bool placed[MAX_PAT];
+  static char *text[MAX_PAT];
+  int i, j, k;
+  for (i = 0; i < nr_pat; i ++) {
+    placed[i] = false;
+    text[i] = src[pat[i].line];
+  }
+  for (k = 0; k < nr_pat; k ++) {
+    // choose the most frequent pattern whose overlapping predecessors are placed
+    int best = -1;
+    for (i = 0; i < nr_pat; i ++) {
+      if (placed[i] || pat[i].region != pat[k].region) continue;
+      for (j = 0; j < i; j ++) {
+        if (!placed[j] && overlap(&pat[j], &pat[i])) break;
+      }
+      if (j < i) continue;
+      if (best == -1 || prof_count[pat[i].line] > prof_count[pat[best].line]) best = i;
+    }
+    placed[best] = true;
+    src[pat[k].line] = text[best];
+  }
+}
+
+// --- source parsing ---
+
+// return the position of `word` in `s` as a whole identifier followed by '('
+static const char* find_call(const char *s, const char *word) {
+  size_t len = strlen(word);
+  const char *p;
+  for (p = strstr(s, word); p != NULL; p = strstr(p + 1, word)) {
+    bool head = (p == s || !(isalnum((unsigned char)p[-1]) || p[-1] == '_'));
+    const char *q = p + len;
+    while (*q == ' ' || *q == '\t') q ++;
+    if (head && *q == '(') return q + 1;
+  }
+  return NULL;
+}
+
+static void read_source() {
+  FILE *fp = fopen(file, "r");
+  if (fp == NULL) { perror(file); exit(1); }
+  char buf[4096];
+  int size = 1024;
+  src = malloc(sizeof(char *) * size);
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    if (nr_line + 1 == size) src = realloc(src, sizeof(char *) * (size *= 2));
+    src[++ nr_line] = strdup(buf);
+  }
+  fclose(fp);
+}
+
+static bool is_directive(const char *p, const char *name) {
+  size_t len = strlen(name);
+  return strncmp(p, name, len) == 0 && !(isalnum((unsigned char)p[len]) || p[len] == '_');
+}
+
+static void parse_directive(const char *p, int line) {
+  while (isspace((unsigned char)*p)) p ++;
+  if (is_directive(p, "define") || is_directive(p, "undef")) return;
+  if (is_directive(p, "if") || is_directive(p, "ifdef") || is_directive(p, "ifndef")) cond_depth ++;
+  else if (is_directive(p, "endif")) {
+    if (cond_depth == 0) die(line, "#endif without #if");
+    cond_depth --;
+  }
+  else if (!is_directive(p, "elif") && !is_directive(p, "else")) {
+    die(line, "only #define, #undef and conditional directives are supported between INSTPAT_START() and INSTPAT_END()");
+  }
+  cond_region ++;
+}
+
+// call `handle_block()` for each INSTPAT_START()/INSTPAT_END() block
+static void parse_source(void (*handle_block)(int start)) {
+  char buf[4096];
+  int line, start = 0;
+  for (line = 1; line <= nr_line; line ++) {
+    strcpy(buf, src[line]);
+    char *comment = strstr(buf, "//");
+    if (comment != NULL) *comment = '\0';
+    const char *p = buf;
+    while (isspace((unsigned char)*p)) p ++;
+    if (*p == '#') {
+      if (start != 0) parse_directive(p + 1, line);
+      continue;
+    }
+    if (find_call(p, "INSTPAT_START") != NULL) {
+      if (start != 0) die(line, "nested INSTPAT_START()");
+      start = line;
+      nr_pat = 0;
+      cond_depth = cond_region = 0;
+    }
+    else if (find_call(p, "INSTPAT_END") != NULL) {
+      if (start == 0) die(line, "INSTPAT_END() without INSTPAT_START()");
+      if (cond_depth != 0) die(line, "#if without #endif before INSTPAT_END()");
+      handle_block(start);
+      start = 0;
+    }
+    else if ((p = find_call(p, "INSTPAT")) != NULL) {
+      if (start == 0) continue;
+      while (isspace((unsigned char)*p)) p ++;
+      if (*p != '"') die(line, "the pattern of INSTPAT() should be a string literal on the same line");
+      parse_pattern(p + 1, line);
+    }
+  }
+  if (start != 0) die(start, "INSTPAT_START() without INSTPAT_END()");
+}
+
+static void reorder_handler(int start) { reorder_block(); }
+
+int main(int argc, char *argv[]) {
+  const char *profile = NULL;
+  if (argc == 4 && strcmp(argv[1], "-p") == 0) { profile = argv[2]; file = argv[3]; }
+  else if (argc == 2) file = argv[1];
+  else {
+    fprintf(stderr, "Usage: %s [-p profile] inst.c\n", argv[0]);
+    return 1;
+  }
+  read_source();
+
+  if (profile != NULL) {
+    load_profile(profile);
+    parse_source(reorder_handler);
+    int line;
+    for (line = 1; line <= nr_line; line ++) fputs(src[line], stdout);
+  }
+  else {
+    printf("// Generated by tools/instpat-tree from %s, do not edit.\n\n", file);
+    parse_source(gen_block);
+  }
+  return 0;
+}
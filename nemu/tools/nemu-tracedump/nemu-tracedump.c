@@ -0,0 +1,248 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+/* Decode a binary instruction trace written by NEMU with CONFIG_BTRACE,
+ * see include/btrace-def.h, and print the records which pass the filters.
+ * The instructions are disassembled with capstone, which is loaded from
+ * $NEMU_HOME/tools/capstone. Without it, only the bytes are printed.
+ *
+ * Usage: nemu-tracedump [-s FIRST] [-n COUNT] [-r LO:HI] [-m] [-q] TRACE
+ *   -s FIRST  start from the instruction FIRST
+ *   -n COUNT  print at most COUNT records
+ *   -r LO:HI  only print the instructions with LO <= pc < HI
+ *   -m        only print the instructions which access memory
+ *   -q        only print a summary of the trace
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <capstone/capstone.h>
+#include <btrace-def.h>
+
+static BTraceHeader hdr;
+static uint64_t word_mask;
+static uint64_t opt_first = 0, opt_count = UINT64_MAX;
+static uint64_t opt_lo = 0, opt_hi = UINT64_MAX;
+static bool opt_mem = false, opt_quiet = false;
+
+static size_t (*cs_disasm_dl)(csh handle, const uint8_t *code,
+    size_t code_size, uint64_t address, size_t count, cs_insn **insn);
+static void (*cs_free_dl)(cs_insn *insn, size_t count);
+static csh handle;
+static bool has_disasm = false;
+
+static void die(const char *msg) {
+  fprintf(stderr, "nemu-tracedump: %s\n", msg);
+  exit(1);
+}
+
+static void init_disasm() {
+  const char *home = getenv("NEMU_HOME");
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/tools/capstone/repo/libcapstone.so.5", home ? home : ".");
+  void *dl = dlopen(path, RTLD_LAZY);
+  if (dl == NULL) {
+    fprintf(stderr, "nemu-tracedump: can not load %s, the instructions are not disassembled\n", path);
+    return;
+  }
+  cs_err (*cs_open_dl)(cs_arch arch, cs_mode mode, csh *handle) = dlsym(dl, "cs_open");
+  cs_disasm_dl = dlsym(dl, "cs_disasm");
+  cs_free_dl = dlsym(dl, "cs_free");
+  if (!cs_open_dl || !cs_disasm_dl || !cs_free_dl) die("bad capstone library");
+
+  cs_arch arch;
+  cs_mode mode;
+  if (strncmp(hdr.isa, "riscv", 5) == 0) {
+    arch = CS_ARCH_RISCV;
+    mode = (hdr.word_size == 8 ? CS_MODE_RISCV64 : CS_MODE_RISCV32) | CS_MODE_RISCVC;
+  } else if (strcmp(hdr.isa, "mips32") == 0) {
+    arch = CS_ARCH_MIPS; mode = CS_MODE_MIPS32;
+  } else if (strcmp(hdr.isa, "loongarch32r") == 0) {
+    arch = CS_ARCH_LOONGARCH; mode = CS_MODE_LOONGARCH32;
+  } else if (strcmp(hdr.isa, "x86") == 0) {
+    arch = CS_ARCH_X86; mode = CS_MODE_32;
+  } else {
+    fprintf(stderr, "nemu-tracedump: unknown ISA %s, the instructions are not disassembled\n", hdr.isa);
+    return;
+  }
+  has_disasm = (cs_open_dl(arch, mode, &handle) == CS_ERR_OK);
+  if (has_disasm && arch == CS_ARCH_X86) {
+    cs_err (*cs_option_dl)(csh handle, cs_opt_type type, size_t value) = dlsym(dl, "cs_option");
+    if (cs_option_dl) cs_option_dl(handle, CS_OPT_SYNTAX, CS_OPT_SYNTAX_ATT);
+  }
+}
+
+static void print_inst(uint64_t pc, const uint8_t *inst, int ilen) {
+  char buf[64], *p = buf;
+  bool x86 = (strcmp(hdr.isa, "x86") == 0);
+  // the bytes are printed as ITRACE does
+  for (int i = 0; i < ilen; i ++) p += sprintf(p, " %02x", inst[x86 ? i : ilen - 1 - i]);
+  printf("0x%0*" PRIx64 ":%-*s ", hdr.word_size * 2, pc, (x86 ? 8 : 4) * 3, buf);
+
+  cs_insn *insn;
+  if (has_disasm && cs_disasm_dl(handle, inst, ilen, pc, 0, &insn) == 1) {
+    printf("%s\t%s", insn->mnemonic, insn->op_str);
+    cs_free_dl(insn, 1);
+  } else if (has_disasm) {
+    printf("(bad)");
+  }
+}
+
+// --- reading ---
+
+static const uint8_t *rp, *rend;
+
+static uint64_t get_varint() {
+  uint64_t v = 0;
+  for (int shift = 0; rp < rend && shift < 64; shift += 7) {
+    uint8_t b = *rp ++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) return v;
+  }
+  die("corrupted record");
+  return 0;
+}
+
+static uint64_t get_delta(uint64_t from) {
+  uint64_t z = get_varint();
+  int64_t d = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+  return (from + d) & word_mask;
+}
+
+static void decompress(uint8_t *out, uint32_t raw_len, const uint8_t *in, uint32_t comp_len) {
+  rp = in;
+  rend = in + comp_len;
+  uint32_t n = 0;
+  while (n < raw_len) {
+    uint64_t lit = get_varint();
+    if (lit > raw_len - n || lit > rend - rp) die("corrupted chunk");
+    memcpy(out + n, rp, lit);
+    rp += lit;
+    n += lit;
+    if (n == raw_len) break;
+    uint64_t m = get_varint();
+    if (m == 0) break;
+    uint64_t off = get_varint();
+    if (off == 0 || off > n || m > raw_len - n) die("corrupted chunk");
+    for (uint64_t i = 0; i < m; i ++, n ++) out[n] = out[n - off];
+  }
+  if (n != raw_len) die("corrupted chunk");
+}
+
+static uint64_t nr_printed = 0;
+
+static void dump_chunk(const BTraceChunk *c, const uint8_t *raw) {
+  rp = raw;
+  rend = raw + c->raw_len;
+  uint64_t pc = 0, mem = 0, idx = c->first_inst;
+  for (uint64_t k = 0; k < c->nr_record; k ++, idx ++) {
+    if (rp >= rend) die("corrupted chunk");
+    uint8_t flags = *rp ++;
+    int ilen = flags & BT_ILEN;
+    if (flags & BT_SKIP) idx += get_varint();
+    if (flags & BT_PC) pc = get_delta(pc);
+    if (rend - rp < ilen) die("corrupted record");
+    const uint8_t *inst = rp;
+    rp += ilen;
+    int rd = -1;
+    uint64_t val = 0;
+    if (flags & BT_REG) {
+      if (rp >= rend) die("corrupted record");
+      rd = *rp ++;
+      val = get_varint();
+    }
+    if (flags & BT_MEM) mem = get_delta(mem);
+
+    bool show = (idx >= opt_first && pc >= opt_lo && pc < opt_hi && (!opt_mem || (flags & BT_MEM)));
+    if (show && nr_printed < opt_count) {
+      printf("%12" PRIu64 " ", idx);
+      print_inst(pc, inst, ilen);
+      if (rd >= 0) printf("\t# %s%d = 0x%0*" PRIx64, (strncmp(hdr.isa, "riscv", 5) == 0 ? "x" : "r"),
+          rd, hdr.word_size * 2, val);
+      if (flags & BT_MEM) printf("%s mem 0x%0*" PRIx64, (rd >= 0 ? "," : "\t#"), hdr.word_size * 2, mem);
+      printf("\n");
+      nr_printed ++;
+    }
+    pc = (pc + ilen) & word_mask;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int o;
+  while ((o = getopt(argc, argv, "s:n:r:mq")) != -1) {
+    switch (o) {
+      case 's': opt_first = strtoull(optarg, NULL, 0); break;
+      case 'n': opt_count = strtoull(optarg, NULL, 0); break;
+      case 'r': {
+        char *end;
+        opt_lo = strtoull(optarg, &end, 0);
+        if (*end != ':') die("the range should be LO:HI");
+        opt_hi = strtoull(end + 1, NULL, 0);
+        break;
+      }
+      case 'm': opt_mem = true; break;
+      case 'q': opt_quiet = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-s FIRST] [-n COUNT] [-r LO:HI] [-m] [-q] TRACE\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc - 1) die("one trace file should be given");
+
+  FILE *fp = fopen(argv[optind], "rb");
+  if (fp == NULL) die("can not open the trace");
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, BTRACE_MAGIC, 8) != 0) {
+    die("not a binary trace of NEMU");
+  }
+  hdr.isa[sizeof(hdr.isa) - 1] = '\0';
+  word_mask = (hdr.word_size >= 8 ? UINT64_MAX : (UINT64_C(1) << (hdr.word_size * 8)) - 1);
+  if (!opt_quiet) init_disasm();
+
+  static uint8_t raw[BTRACE_CHUNK_SIZE], comp[BTRACE_CHUNK_SIZE];
+  uint64_t nr_chunk = 0, nr_record = 0, raw_total = 0, comp_total = 0;
+  BTraceChunk c;
+  while (fread(&c, sizeof(c), 1, fp) == 1) {
+    if (c.raw_len > BTRACE_CHUNK_SIZE || c.comp_len > c.raw_len) die("corrupted chunk");
+    nr_chunk ++;
+    nr_record += c.nr_record;
+    raw_total += c.raw_len;
+    comp_total += c.comp_len;
+    bool skip = opt_quiet || nr_printed >= opt_count || c.last_inst < opt_first;
+    if (skip) {
+      if (fseek(fp, c.comp_len, SEEK_CUR) != 0) die("truncated trace");
+      continue;
+    }
+    uint8_t *data = (c.comp_len == c.raw_len ? raw : comp);
+    if (fread(data, c.comp_len, 1, fp) != 1) die("truncated trace");
+    if (data == comp) decompress(raw, c.raw_len, comp, c.comp_len);
+    dump_chunk(&c, raw);
+  }
+  fclose(fp);
+
+  if (opt_quiet) {
+    printf("ISA: %s\n", hdr.isa);
+    printf("instructions: %" PRIu64 " in %" PRIu64 " chunks\n", nr_record, nr_chunk);
+    printf("records: %" PRIu64 " bytes, compressed to %" PRIu64 " bytes (%.2f bytes per instruction)\n",
+        raw_total, comp_total, nr_record ? (double)comp_total / nr_record : 0.0);
+  }
+  return 0;
+}